@@ -32,6 +32,15 @@ public:
         return Aabb(new_x, new_y, new_z);
     }
 
+    bool contains(const Point3d& p) const {
+        return x.contains(p.x()) && y.contains(p.y()) && z.contains(p.z());
+    }
+
+    double surface_area() const {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
     const Interval& axis(int n) const {
         if (n == 1) {
             return y;
@@ -67,6 +76,15 @@ public:
     }
 };
 
+// The box a fraction 't' of the way from 'a' to 'b'. For contents that move linearly between the
+// two boxes, it bounds them at that point of the motion.
+inline Aabb lerp(const Aabb& a, const Aabb& b, double t) {
+    auto mix = [t](const Interval& i0, const Interval& i1) {
+        return Interval(i0.min + t * (i1.min - i0.min), i0.max + t * (i1.max - i0.max));
+    };
+    return Aabb(mix(a.x, b.x), mix(a.y, b.y), mix(a.z, b.z));
+}
+
 Aabb operator+(const Aabb& bbox, const Vector3d& offset) {
     return Aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
@@ -0,0 +1,369 @@
+// Benchmark suite: microbenchmarks of the intersection and texture kernels plus end-to-end renders
+// of the built-in scenes with thread scaling. Results are written to stdout as JSON.
+//
+//   raytracing_bench [--quick] [--threads N] [--scene name]...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "hittable_list.hpp"
+#include "light_bvh.hpp"
+#include "perlin.hpp"
+#include "quad.hpp"
+#include "rtweekend.hpp"
+#include "scene.hpp"
+#include "scenes.hpp"
+#include "sphere.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Keeps benchmark results observable so the loops are not optimized away.
+static volatile double sink;
+
+// Forwards every query to the wrapped world and counts the rays traced through it, closest-hit
+// and shadow rays alike. Counts are per thread so the renders do not contend on a shared counter.
+class CountingHittable : public Hittable {
+public:
+    static thread_local uint64_t rays;
+
+    CountingHittable(const Hittable& world) : world(world) {}
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        ++rays;
+        return world.hit(r, ray_t, rec);
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        ++rays;
+        return world.occluded(r, ray_t);
+    }
+
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        ++rays;
+        return world.transmittance(r, ray_t);
+    }
+
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        return world.hit_interval(r, ray_t, span);
+    }
+
+    Aabb bounding_box() const override { return world.bounding_box(); }
+
+    Aabb bounding_box_at(double time) const override { return world.bounding_box_at(time); }
+
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        return world.pdf_value(origin, direction);
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        return world.random(origin, sampler);
+    }
+
+private:
+    const Hittable& world;
+};
+
+thread_local uint64_t CountingHittable::rays = 0;
+
+class Json {
+public:
+    void open(const std::string& key = "") { begin(key, '{'); }
+    void close() { end('}'); }
+    void open_array(const std::string& key) { begin(key, '['); }
+    void close_array() { end(']'); }
+
+    void field(const std::string& key, double value) {
+        separate();
+        std::cout << indent() << '"' << key << "\": " << value;
+    }
+
+    void field(const std::string& key, const std::string& value) {
+        separate();
+        std::cout << indent() << '"' << key << "\": \"" << value << '"';
+    }
+
+private:
+    std::vector<bool> first;
+
+    std::string indent() const { return std::string(2 * first.size(), ' '); }
+
+    void separate() {
+        if (!first.empty()) {
+            std::cout << (first.back() ? "\n" : ",\n");
+            first.back() = false;
+        }
+    }
+
+    void begin(const std::string& key, char bracket) {
+        separate();
+        std::cout << indent();
+        if (!key.empty()) {
+            std::cout << '"' << key << "\": ";
+        }
+        std::cout << bracket;
+        first.push_back(true);
+    }
+
+    void end(char bracket) {
+        first.pop_back();
+        std::cout << '\n' << indent() << bracket;
+        if (first.empty()) {
+            std::cout << '\n';
+        }
+    }
+};
+
+// Runs 'body' over 'count' iterations and reports nanoseconds per iteration. 'body' is a template
+// parameter so it is inlined into the timed loop instead of called through a pointer.
+template <typename Body>
+static void micro(Json& json, const std::string& name, int count, const Body& body) {
+    auto result = 0.0;
+    auto start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        result += body(i);
+    }
+    auto elapsed = seconds_since(start);
+    sink = result;
+
+    json.open();
+    json.field("name", name);
+    json.field("iterations", count);
+    json.field("ns_per_op", 1e9 * elapsed / count);
+    json.close();
+}
+
+static std::vector<Ray> random_rays(int count, const Point3d& target, double spread) {
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        auto origin = target + spread * random_unit_vector() * 3;
+        auto aim = target + spread * Vector3d::random(-1, 1);
+        rays.emplace_back(origin, aim - origin, random_double());
+    }
+    return rays;
+}
+
+static void microbenchmarks(Json& json, bool quick) {
+    auto n = quick ? 100000 : 2000000;
+    auto rays = random_rays(4096, Point3d(0, 0, 0), 1);
+    auto mask = static_cast<int>(rays.size()) - 1;
+
+    json.open_array("micro");
+
+    Aabb box(Point3d(-0.5, -0.5, -0.5), Point3d(0.5, 0.5, 0.5));
+    micro(json, "aabb_hit", n, [&](int i) {
+        return box.hit(rays[i & mask], Interval(0.001, infinity)) ? 1.0 : 0.0;
+    });
+
+    auto mat = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    Sphere sphere(Point3d(0, 0, 0), 0.7, mat);
+    micro(json, "sphere_hit", n, [&](int i) {
+        HitRecord rec;
+        return sphere.hit(rays[i & mask], Interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+
+    Quad quad(Point3d(-0.5, -0.5, 0), Vector3d(1, 0, 0), Vector3d(0, 1, 0), mat);
+    micro(json, "quad_hit", n, [&](int i) {
+        HitRecord rec;
+        return quad.hit(rays[i & mask], Interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+
+    HittableList spheres;
+    auto object_count = quick ? 10000 : 20000;
+    std::vector<Point3d> centers;
+    for (int i = 0; i < object_count; ++i) {
+        centers.push_back(Point3d::random(-50, 50));
+        spheres.add(make_shared<Sphere>(centers.back(), 0.5, mat));
+    }
+    micro(json, "bvh_build_" + std::to_string(object_count) + "_spheres", quick ? 1 : 3,
+          [&](int) { return BvhNode(spheres).bounding_box().x.size(); });
+
+    BvhNode bvh(spheres);
+    auto bvh_rays = random_rays(4096, Point3d(0, 0, 0), 50);
+    micro(json, "bvh_hit_" + std::to_string(object_count) + "_spheres", n / 4, [&](int i) {
+        HitRecord rec;
+        return bvh.hit(bvh_rays[i & mask], Interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+
+    // the same spheres moving in random directions, each ray at a random time
+    HittableList movers;
+    for (const auto& c : centers) {
+        movers.add(make_shared<Sphere>(c, c + 3 * random_unit_vector(), 0.5, mat));
+    }
+    BvhNode motion_bvh(movers);
+    micro(json, "bvh_hit_" + std::to_string(object_count) + "_moving_spheres", n / 4, [&](int i) {
+        HitRecord rec;
+        return motion_bvh.hit(bvh_rays[i & mask], Interval(0.001, infinity), rec) ? rec.t : 0.0;
+    });
+
+    Perlin noise;
+    micro(json, "perlin_turb", n / 4, [&](int i) {
+        return noise.turb(Point3d(i * 0.013, i * 0.007, i * 0.011));
+    });
+
+    json.close_array();
+}
+
+class RenderResult {
+public:
+    double seconds;
+    uint64_t rays;
+    int samples_per_pixel;  // rendered, over all workers
+};
+
+// Renders the scene the way main does, splitting the samples over at most 'threads' cameras with
+// the remainder going to the first ones, and reports the wall time and rays traced.
+static RenderResult render(const Hittable& world, const Hittable& lights, Camera cam, int threads) {
+    CountingHittable counted(world);
+    auto total_samples = cam.samples_per_pixel;
+    auto workers = std::max(1, std::min(threads, total_samples));
+    cam.sample_count = total_samples;
+
+    std::clog.setstate(std::ios::failbit);  // silence the scanline progress log
+    auto start = Clock::now();
+
+    std::vector<std::future<uint64_t>> futures;
+    auto rendered = 0;
+    for (int t = 0; t < workers; ++t) {
+        cam.samples_per_pixel = total_samples / workers + (t < total_samples % workers ? 1 : 0);
+        cam.sample_offset = rendered;
+        rendered += cam.samples_per_pixel;
+        futures.push_back(std::async(std::launch::async, [&counted, &lights, cam]() mutable {
+            CountingHittable::rays = 0;
+            cam.render(counted, lights);
+            return CountingHittable::rays;
+        }));
+    }
+
+    uint64_t rays = 0;
+    for (auto& f : futures) {
+        rays += f.get();
+    }
+
+    auto seconds = seconds_since(start);
+    std::clog.clear();
+    return {seconds, rays, rendered};
+}
+
+static void scene_benchmarks(Json& json, const std::vector<std::string>& names, bool quick,
+                             int max_threads) {
+    auto width = quick ? 64 : 160;
+    auto spp = quick ? 8 : 32;
+
+    json.open_array("scenes");
+
+    for (const auto& name : names) {
+        srand(1);  // same random placements and sample sequence on every run
+
+        auto build_start = Clock::now();
+        SceneDescription description;
+        builtin_scene(name, description);
+        HittableList world, lights;
+        Camera cam;
+        build_scene(description.view(), world, lights, cam);
+        LightBvh light_tree(lights);  // what main samples the lights through
+        auto build_ms = 1000 * seconds_since(build_start);
+
+        cam.image_width = width;
+        cam.samples_per_pixel = spp;
+        cam.max_depth = std::min(cam.max_depth, 16);
+        auto height = std::max(1, static_cast<int>(width / cam.aspect_ratio));
+
+        json.open();
+        json.field("name", name);
+        json.field("objects", static_cast<double>(description.objects.size()));
+        json.field("lights", static_cast<double>(light_tree.size()));
+        json.field("build_ms", build_ms);
+        json.field("width", width);
+        json.field("height", height);
+        json.field("spp", spp);
+        json.open_array("threads");
+
+        std::vector<int> thread_counts;
+        for (int threads = 1; threads < max_threads; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(max_threads);
+
+        double single_thread_seconds = 0;
+        for (auto threads : thread_counts) {
+            srand(1);
+            auto result = render(world, light_tree, cam, threads);
+            if (threads == 1) {
+                single_thread_seconds = result.seconds;
+            }
+
+            json.open();
+            json.field("threads", threads);
+            json.field("seconds", result.seconds);
+            json.field("mrays_per_second", result.rays / result.seconds / 1e6);
+            auto samples = static_cast<double>(width) * height * result.samples_per_pixel;
+            json.field("samples_per_second", samples / result.seconds);
+            json.field("scaling_efficiency", single_thread_seconds / (threads * result.seconds));
+            json.close();
+        }
+
+        json.close_array();
+        json.close();
+    }
+
+    json.close_array();
+}
+
+int main(int argc, char** argv) {
+    auto quick = false;
+    auto max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::string> scenes;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            max_threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scenes.push_back(argv[++i]);
+        } else {
+            std::cerr << "usage: raytracing_bench [--quick] [--threads N] [--scene name]...\n";
+            return 1;
+        }
+    }
+
+    if (scenes.empty()) {
+        // the high-quality final scene differs from final_scene only in its camera settings
+        for (const auto& name : builtin_scene_names()) {
+            if (name != "final_scene_hq") {
+                scenes.push_back(name);
+            }
+        }
+    }
+
+    const auto& known = builtin_scene_names();
+    for (const auto& name : scenes) {
+        if (std::find(known.begin(), known.end(), name) == known.end()) {
+            std::cerr << "unknown scene '" << name << "'\n";
+            return 1;
+        }
+    }
+
+    Json json;
+    json.open();
+    json.field("quick", quick ? 1 : 0);
+    json.field("max_threads", max_threads);
+    srand(1);
+    microbenchmarks(json, quick);
+    scene_benchmarks(json, scenes, quick, max_threads);
+    json.close();
+}
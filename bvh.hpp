@@ -7,16 +7,50 @@
 #include "hittable_list.hpp"
 #include "rtweekend.hpp"
 
+// Bounding volume hierarchy over objects that may move during the shutter interval. Every node
+// covers a time span and stores its bounds at both ends of it; traversal interpolates between the
+// two boxes at the ray's time, so the boxes of moving objects stay as tight as their static
+// counterparts instead of covering the whole sweep. Where the members move apart so that the
+// interpolated boxes get loose, a node can split in time instead of space, with each child
+// rebuilt for half of the span.
 class BvhNode : public Hittable {
 public:
-    BvhNode(const HittableList& list) : BvhNode(list.objects, 0, list.objects.size()) {}
-    BvhNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, size_t start, size_t end) {
+    // 'temporal_splits' bounds how many times a path from the root may split in time; 0 builds a
+    // purely spatial hierarchy. Each temporal split duplicates the subtree below it.
+    BvhNode(const HittableList& list, int temporal_splits = 2)
+        : BvhNode(list.objects, 0, list.objects.size(), Interval(0, 1), temporal_splits) {}
+
+    BvhNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, size_t start, size_t end,
+            Interval time = Interval(0, 1), int temporal_splits = 0) {
         auto objects = src_objects;
 
-        int axis = random_int(0, 2);
-        auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
+        for (auto i = start; i < end; ++i) {
+            bbox = Aabb(bbox, objects[i]->bounding_box_at(time.min));
+            end_box = Aabb(end_box, objects[i]->bounding_box_at(time.max));
+        }
+        moving = !same_box(bbox, end_box);
+        time_start = time.min;
+        time_scale = 1 / time.size();
 
         size_t object_span = end - start;
+        auto mid_time = time.min + time.size() / 2;
+
+        if (moving && temporal_splits > 0 && object_span >= min_temporal_split_objects &&
+            interpolation_is_loose(objects, start, end, mid_time)) {
+            split_in_time = true;
+            left = std::make_shared<BvhNode>(objects, start, end, Interval(time.min, mid_time),
+                                             temporal_splits - 1);
+            right = std::make_shared<BvhNode>(objects, start, end, Interval(mid_time, time.max),
+                                              temporal_splits - 1);
+            return;
+        }
+
+        // objects are ordered by the boxes they sweep over the span
+        int axis = random_int(0, 2);
+        auto comparator = [axis, time](const std::shared_ptr<Hittable>& a,
+                                       const std::shared_ptr<Hittable>& b) {
+            return swept_min(*a, time, axis) < swept_min(*b, time, axis);
+        };
 
         if (object_span == 1) {
             left = right = objects[start];
@@ -33,15 +67,21 @@ public:
 
             auto mid = start + object_span / 2;
 
-            left = std::make_shared<BvhNode>(objects, start, mid);
-            right = std::make_shared<BvhNode>(objects, mid, end);
+            left = std::make_shared<BvhNode>(objects, start, mid, time, temporal_splits);
+            right = std::make_shared<BvhNode>(objects, mid, end, time, temporal_splits);
         }
 
-        bbox = Aabb(left->bounding_box(), right->bounding_box());
+        // any-hit queries try the child with more surface area first; it is the one more likely to
+        // be struck, and no ordering by distance is needed when any intersection will do
+        occlude_left_first =
+            left->bounding_box().surface_area() >= right->bounding_box().surface_area();
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
-        if (!bbox.hit(r, ray_t)) {
+        if (split_in_time) {
+            return child_at(r.time()).hit(r, ray_t, rec);
+        }
+        if (!box_hit(r, ray_t)) {
             return false;
         }
 
@@ -51,31 +91,126 @@ public:
         return hit_left || hit_right;
     }
 
-    Aabb bounding_box() const override { return bbox; }
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (split_in_time) {
+            return child_at(r.time()).occluded(r, ray_t);
+        }
+        if (!box_hit(r, ray_t)) {
+            return false;
+        }
+
+        const auto& first = occlude_left_first ? left : right;
+        const auto& second = occlude_left_first ? right : left;
+
+        return first->occluded(r, ray_t) || (second != first && second->occluded(r, ray_t));
+    }
+
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        if (split_in_time) {
+            return child_at(r.time()).transmittance(r, ray_t);
+        }
+        if (!box_hit(r, ray_t)) {
+            return 1;
+        }
+
+        const auto& first = occlude_left_first ? left : right;
+        const auto& second = occlude_left_first ? right : left;
+
+        auto result = first->transmittance(r, ray_t);
+        if (result <= 0 || second == first) {
+            return result;
+        }
+
+        return result * second->transmittance(r, ray_t);
+    }
+
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        if (split_in_time) {
+            return child_at(r.time()).hit_interval(r, ray_t, span);
+        }
+        if (!box_hit(r, ray_t)) {
+            return false;
+        }
+
+        Interval left_span, right_span;
+        bool hit_left = left->hit_interval(r, ray_t, left_span);
+        bool hit_right = right != left && right->hit_interval(r, ray_t, right_span);
+
+        if (hit_left && hit_right) {
+            span = Interval(left_span, right_span);
+        } else if (hit_left || hit_right) {
+            span = hit_left ? left_span : right_span;
+        }
+
+        return hit_left || hit_right;
+    }
+
+    Aabb bounding_box() const override {
+        if (split_in_time) {
+            return Aabb(left->bounding_box(), right->bounding_box());
+        }
+        return Aabb(bbox, end_box);
+    }
+
+    Aabb bounding_box_at(double t) const override {
+        if (split_in_time) {
+            return child_at(t).bounding_box_at(t);
+        }
+        return moving ? lerp(bbox, end_box, fraction(t)) : bbox;
+    }
 
 private:
+    // A temporal split is made only where the boxes interpolated at mid-span would be this many
+    // times the surface of the members' actual bounds there.
+    static constexpr double temporal_split_ratio = 1.2;
+    static constexpr size_t min_temporal_split_objects = 4;
+
+    // Both boxes sit in the node itself: a moving node costs no extra cache miss to test.
+    Aabb bbox;     // at the start of the span, which for static contents is all of it
+    Aabb end_box;  // at the end of the span
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
-    Aabb bbox;
+    double time_start;
+    double time_scale;  // 1 / length of the span
+    bool moving;
+    bool split_in_time = false;  // 'left' covers the first half of the span, 'right' the second
+    bool occlude_left_first = true;
+
+    double fraction(double t) const { return Interval(0, 1).clamp((t - time_start) * time_scale); }
 
-    static bool box_compare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b,
-                            int axis_index) {
-        return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
+    bool box_hit(const Ray& r, Interval ray_t) const {
+        if (!moving) {
+            return bbox.hit(r, ray_t);
+        }
+        return lerp(bbox, end_box, fraction(r.time())).hit(r, ray_t);
     }
 
-    static bool box_x_compare(const std::shared_ptr<Hittable> a,
-                              const std::shared_ptr<Hittable> b) {
-        return box_compare(a, b, 0);
+    const Hittable& child_at(double t) const {
+        return (t - time_start) * time_scale < 0.5 ? *left : *right;
     }
 
-    static bool box_y_compare(const std::shared_ptr<Hittable> a,
-                              const std::shared_ptr<Hittable> b) {
-        return box_compare(a, b, 1);
+    static double swept_min(const Hittable& object, Interval time, int axis) {
+        return fmin(object.bounding_box_at(time.min).axis(axis).min,
+                    object.bounding_box_at(time.max).axis(axis).min);
     }
 
-    static bool box_z_compare(const std::shared_ptr<Hittable> a,
-                              const std::shared_ptr<Hittable> b) {
-        return box_compare(a, b, 2);
+    static bool same_box(const Aabb& a, const Aabb& b) {
+        for (int n = 0; n < 3; ++n) {
+            if (a.axis(n).min != b.axis(n).min || a.axis(n).max != b.axis(n).max) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool interpolation_is_loose(const std::vector<std::shared_ptr<Hittable>>& objects,
+                                size_t start, size_t end, double mid_time) const {
+        Aabb actual;
+        for (auto i = start; i < end; ++i) {
+            actual = Aabb(actual, objects[i]->bounding_box_at(mid_time));
+        }
+        return lerp(bbox, end_box, 0.5).surface_area() >
+               temporal_split_ratio * actual.surface_area();
     }
 };
 
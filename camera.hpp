@@ -1,12 +1,63 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 #include "color.hpp"
+#include "environment.hpp"
+#include "framebuffer.hpp"
 #include "hittable.hpp"
+#include "irradiance_cache.hpp"
 #include "material.hpp"
+#include "numa.hpp"
+#include "photon_map.hpp"
+#include "perf_counters.hpp"
 #include "rtweekend.hpp"
+#include "sampler.hpp"
+#include "trace.hpp"
+
+// Scene features the renderer can leave out. The camera and integrator are instantiated for every
+// combination and each render runs the one matching what the scene actually uses, so the code and
+// the sample dimensions of missing features drop out of the inner loops.
+enum class RenderFeature : unsigned {
+    depth_of_field = 1,  // derived from the camera's defocus_angle
+    motion_blur = 2,     // rays carry a time
+    emission = 4,        // emitters or an environment map, found by rays and sampled as lights
+    volumes = 8,         // participating media, which make shadow rays compute transmittance
+};
+
+inline constexpr unsigned all_render_features = 15;
+
+constexpr unsigned feature_bit(RenderFeature f) { return static_cast<unsigned>(f); }
+
+constexpr bool has_feature(unsigned features, RenderFeature f) {
+    return (features & feature_bit(f)) != 0;
+}
+
+// Controls for Camera::render_progressive().
+class ProgressiveSettings {
+public:
+    double time_budget = 0;         // wall-clock seconds, 0 to run until the sample cap
+    double publish_interval = 2;    // minimum seconds between published images
+    int coarse_levels = 3;          // 1 spp previews at 1/8, 1/4 and 1/2 resolution
+    int threads = 4;
+    bool pin_threads = false;  // pin band threads to CPUs spread over the NUMA nodes
+};
+
+// A rectangle of pixels [x0, x1) x [y0, y1); the default covers any image.
+struct PixelRegion {
+    int x0 = 0, y0 = 0;
+    int x1 = std::numeric_limits<int>::max(), y1 = std::numeric_limits<int>::max();
+
+    bool contains(int i, int j) const { return i >= x0 && i < x1 && j >= y0 && j < y1; }
+};
 
 class Camera {
 public:
@@ -14,6 +65,7 @@ public:
     int image_width = 100;
     int samples_per_pixel = 10;
     int max_depth = 10;
+    int russian_roulette_depth = 3;  // bounces before paths may be terminated by throughput
     Color background;
 
     double vfov = 90;
@@ -24,32 +76,173 @@ public:
     double defocus_angle = 0;
     double focus_dist = 10;
 
-    std::vector<std::vector<Color>> render(const Hittable& world) {
+    SamplerType sampler_type = SamplerType::sobol;
+    int sample_offset = 0;  // index of the first sample, so cameras sharing an image differ
+    int sample_count = 0;   // per pixel over every camera sharing the image; 0: this one
+
+    // RenderFeature bits the scene may need; build_scene() narrows this to what a scene uses.
+    // Depth of field follows defocus_angle instead.
+    unsigned features = all_render_features;
+
+    // Only pixels inside 'region' are rendered; the rest of the FrameBuffer stays zero.
+    PixelRegion region;
+
+    // Polled once per scanline when set. Once it reads true the render stops early and returns the
+    // partial image.
+    const std::atomic<bool>* cancel = nullptr;
+
+    // When set, the first diffuse surface a path reaches is shaded from direct light plus indirect
+    // irradiance interpolated from this cache, which renders fill as they go and threads share.
+    // Left null, every path is traced in full, which is the unbiased reference.
+    std::shared_ptr<IrradianceCache> irradiance_cache;
+
+    // When set, caustics reach diffuse surfaces from this photon map instead of from paths that
+    // happen to hit a light after a specular bounce.
+    std::shared_ptr<const PhotonMap> caustics;
+
+    // When set, rays that leave the scene see this map instead of 'background', and it is sampled
+    // as a light along with 'lights'.
+    std::shared_ptr<const EnvironmentMap> environment;
+
+    // The samples per pixel the whole image gets, which the sampler spreads its strata over.
+    int total_samples() const { return std::max(sample_count, samples_per_pixel); }
+
+    // 'lights' holds the emitters that are sampled explicitly at diffuse bounces. Every emissive
+    // object in 'world' should be registered in it; it may be an empty HittableList.
+    FrameBuffer render(const Hittable& world, const Hittable& lights) {
         initialize();
+        share_light_samples(lights);
 
-        std::vector<std::vector<Color>> output(image_height,
-                                               std::vector<Color>(image_width, Color()));
+        FrameBuffer output(image_width, image_height);
+        output.samples = samples_per_pixel;
+        PhaseScope tracing(Phase::tracing);
+        Tracer::name_thread("render worker");
+        TraceScope trace("render");
+        auto sampler = make_sampler(sampler_type, total_samples());
 
         // std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
-        for (int j = 0; j < image_height; ++j) {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i) {
-                Color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    Ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+        with_features([&](auto f) {
+            constexpr auto F = decltype(f)::value;
+            auto j1 = std::min(image_height, region.y1), i1 = std::min(image_width, region.x1);
+            for (int j = std::max(0, region.y0); j < j1 && !cancelled(); ++j) {
+                std::clog << "\rScanlines remaining: " << (j1 - j) << ' ' << std::flush;
+                TraceScope scanline("scanline", j);
+                for (int i = std::max(0, region.x0); i < i1; ++i) {
+                    render_pixel<F>(i, j, world, lights, *sampler, output);
                 }
-
-                output[j][i] = pixel_color;
             }
-        }
+        });
 
         std::clog << "\rDone.                 \n";
 
         return output;
     }
 
+    // Tiled rendering, for spreading the pixels of one or more views over a shared pool of
+    // threads. prepare() sets the view up and returns the empty image; render_tile() then adds
+    // every sample of the pixels inside both 'tile' and 'region' to it, and may be called from any
+    // number of threads at once for tiles that do not overlap.
+    FrameBuffer prepare(const Hittable& lights) {
+        initialize();
+        share_light_samples(lights);
+
+        FrameBuffer output(image_width, image_height);
+        output.samples = samples_per_pixel;
+        return output;
+    }
+
+    void render_tile(const Hittable& world, const Hittable& lights, const PixelRegion& tile,
+                     Sampler& sampler, FrameBuffer& output) const {
+        with_features([&](auto f) {
+            constexpr auto F = decltype(f)::value;
+            auto j1 = std::min({image_height, region.y1, tile.y1});
+            auto i1 = std::min({image_width, region.x1, tile.x1});
+            for (int j = std::max({0, region.y0, tile.y0}); j < j1 && !cancelled(); ++j) {
+                for (int i = std::max({0, region.x0, tile.x0}); i < i1; ++i) {
+                    render_pixel<F>(i, j, world, lights, sampler, output);
+                }
+            }
+        });
+    }
+
+    // Renders in passes that each improve on the last: 1 spp passes at coarse resolutions with
+    // every sample filling its block, then full-resolution 1 spp passes accumulated until
+    // samples_per_pixel is reached or the time budget runs out. The best image so far is handed to
+    // 'publish' at most every publish_interval seconds and once more at the end. A pass that would
+    // overrun the deadline is abandoned, so the result only ever contains whole passes. The first
+    // pass always runs to completion, however short the budget, so the result has at least one
+    // sample unless the render is cancelled.
+    FrameBuffer render_progressive(const Hittable& world, const Hittable& lights,
+                                   const ProgressiveSettings& settings,
+                                   const std::function<void(const FrameBuffer&)>& publish) {
+        using Clock = std::chrono::steady_clock;
+
+        initialize();
+        share_light_samples(lights);
+
+        auto start = Clock::now();
+        auto elapsed = [&]() {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+        auto deadline = settings.time_budget > 0 ? settings.time_budget : infinity;
+        auto last_publish = -infinity;
+        auto last_pass = 0.0;
+
+        FrameBuffer best(image_width, image_height);
+
+        auto pass_fits = [&]() {
+            return !cancelled() && (best.samples == 0 || elapsed() + last_pass <= deadline);
+        };
+        auto pass_deadline = [&]() { return best.samples == 0 ? infinity : deadline; };
+        auto offer = [&](bool force) {
+            auto due = force || elapsed() - last_publish >= settings.publish_interval;
+            if (best.samples > 0 && due) {
+                publish(best);
+                last_publish = elapsed();
+            }
+        };
+
+        for (int level = settings.coarse_levels; level > 0 && pass_fits(); --level) {
+            auto pass_start = elapsed();
+            FrameBuffer pass(image_width, image_height);
+            auto scale = 1 << level;
+            TraceScope trace("preview pass", scale);
+            if (!render_pass(world, lights, scale, sample_offset, pass, settings, elapsed,
+                             pass_deadline())) {
+                break;
+            }
+            best = std::move(pass);
+            last_pass = elapsed() - pass_start;
+            std::clog << "Preview at 1/" << scale << " resolution, " << elapsed() << "s\n";
+            offer(false);
+        }
+
+        FrameBuffer accumulated(image_width, image_height);
+
+        while (accumulated.samples < samples_per_pixel && pass_fits()) {
+            auto pass_start = elapsed();
+            FrameBuffer pass(image_width, image_height);
+            TraceScope trace("sample pass", accumulated.samples);
+            if (!render_pass(world, lights, 1, sample_offset + accumulated.samples, pass,
+                             settings, elapsed, pass_deadline())) {
+                break;
+            }
+            accumulated += pass;
+            last_pass = elapsed() - pass_start;
+            std::clog << "\rSamples per pixel: " << accumulated.samples << ", " << elapsed() << "s "
+                      << std::flush;
+
+            best = accumulated;
+            offer(false);
+        }
+
+        std::clog << "\rDone after " << elapsed() << "s.                         \n";
+        offer(true);
+
+        return best;
+    }
+
 private:
     int image_height;
     Point3d center;
@@ -59,6 +252,46 @@ private:
     Vector3d u, v, w;
     Vector3d defocus_disk_u;
     Vector3d defocus_disk_v;
+    double pixel_spread;  // angle subtended by one pixel, the spread of the ray cone
+    double environment_share = 0;  // fraction of light samples taken from the environment
+
+    bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
+
+    // Sampler dimensions: the camera ray uses the first ones, then every bounce reads from its own
+    // block, so a decision at a given depth always sees the same dimension of the sequence.
+    static constexpr int pixel_dimension = 0;
+    static constexpr int lens_dimension = 1;
+    static constexpr int time_dimension = 2;
+    static constexpr int first_bounce_dimension = 3;
+    static constexpr int bounce_dimensions = 8;
+    static constexpr int light_dimension = 0;  // light choice and position, up to 5 dimensions
+    static constexpr int bsdf_dimension = 5;
+    static constexpr int roulette_dimension = 6;
+
+    // Calls 'body' with std::integral_constant<unsigned, F>, where F holds the scene's features
+    // plus depth of field when the lens has an aperture and emission when there is an environment.
+    template <typename Body>
+    void with_features(const Body& body) const {
+        auto enabled = features & ~feature_bit(RenderFeature::depth_of_field);
+        if (defocus_angle > 0) {
+            enabled |= feature_bit(RenderFeature::depth_of_field);
+        }
+        if (environment) {
+            enabled |= feature_bit(RenderFeature::emission);
+        }
+        dispatch_features(enabled, body);
+    }
+
+    template <unsigned F = 0, unsigned Bit = 1, typename Body>
+    static void dispatch_features(unsigned enabled, const Body& body) {
+        if constexpr (Bit > all_render_features) {
+            body(std::integral_constant<unsigned, F>());
+        } else if (enabled & Bit) {
+            dispatch_features<F | Bit, Bit * 2>(enabled, body);
+        } else {
+            dispatch_features<F, Bit * 2>(enabled, body);
+        }
+    }
 
     void initialize() {
         image_height = static_cast<int>(image_width / aspect_ratio);
@@ -84,6 +317,7 @@ private:
         // calculate the horizontal and vertical delta vectors from pixel to pixel
         pixel_delta_u = viewport_u / image_width;
         pixel_delta_v = viewport_v / image_height;
+        pixel_spread = viewport_height / focus_dist / image_height;
 
         // calculate the location of the upper left pixel
         auto viewport_upper_left = center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
@@ -95,49 +329,395 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    Color ray_color(const Ray& r, int depth, const Hittable& world) const {
-        HitRecord rec;
+    // Splits light samples evenly between the environment and 'lights', or gives them all to the
+    // environment when 'lights' is empty (and so has an empty bounding box).
+    void share_light_samples(const Hittable& lights) {
+        if (!environment) {
+            environment_share = 0;
+        } else {
+            environment_share = lights.bounding_box().x.size() < 0 ? 1 : 0.5;
+        }
+    }
+
+    // Adds all samples_per_pixel samples of pixel (i, j) to 'output'.
+    template <unsigned F>
+    void render_pixel(int i, int j, const Hittable& world, const Hittable& lights,
+                      Sampler& sampler, FrameBuffer& output) const {
+        for (int sample = 0; sample < samples_per_pixel; ++sample) {
+            sampler.start(i, j, sample_offset + sample);
+            Ray r = get_ray<F>(i, j, sampler);
+            SampleAov aov;
+            output.color[j][i] += ray_color<F>(r, world, lights, sampler, &aov);
+            output.albedo[j][i] += aov.albedo;
+            output.normal[j][i] += aov.normal;
+            output.depth[j][i] += aov.depth;
+        }
+    }
+
+    // Adds sample 'sample_index' of one pixel per 'scale' x 'scale' block to 'pass', splitting the
+    // block rows into bands across settings.threads threads. Returns false if the deadline passed
+    // before the pass completed.
+    template <typename Elapsed>
+    bool render_pass(const Hittable& world, const Hittable& lights, int scale, int sample_index,
+                     FrameBuffer& pass, const ProgressiveSettings& settings,
+                     const Elapsed& elapsed, double deadline) const {
+        auto threads = settings.threads;
+        auto rows = (image_height + scale - 1) / scale;
+        auto band = (rows + threads - 1) / threads;
+        std::vector<std::future<bool>> bands;
+
+        for (int t = 0; t < threads; ++t) {
+            auto r0 = t * band, r1 = std::min(rows, (t + 1) * band);
+            bands.push_back(std::async(std::launch::async, [&, t, r0, r1]() {
+                if (settings.pin_threads) {
+                    pin_current_thread(NumaTopology::instance().worker_cpu(t));
+                    pass.localize_rows(std::min(image_height, r0 * scale),
+                                       std::min(image_height, r1 * scale));
+                }
+                PhaseScope tracing(Phase::tracing);
+                Tracer::name_thread("pass worker");
+                TraceScope trace("pass band", scale);
+                auto sampler = make_sampler(sampler_type, total_samples());
+                auto completed = true;
+                with_features([&](auto f) {
+                    constexpr auto F = decltype(f)::value;
+                    for (int row = r0; row < r1; ++row) {
+                        if (elapsed() > deadline || cancelled()) {
+                            completed = false;
+                            return;
+                        }
+                        auto j = row * scale;
+                        TraceScope scanline("scanline", j);
+                        for (int i = 0; i < image_width; i += scale) {
+                            auto x0 = std::min(i + scale / 2, image_width - 1);
+                            auto y0 = std::min(j + scale / 2, image_height - 1);
+                            if (!region.contains(x0, y0)) {
+                                continue;
+                            }
+                            sampler->start(x0, y0, sample_index);
+                            SampleAov aov;
+                            auto pixel_color = ray_color<F>(get_ray<F>(x0, y0, *sampler), world,
+                                                            lights, *sampler, &aov);
+
+                            for (int y = j; y < std::min(j + scale, image_height); ++y) {
+                                for (int x = i; x < std::min(i + scale, image_width); ++x) {
+                                    pass.color[y][x] = pixel_color;
+                                    pass.albedo[y][x] = aov.albedo;
+                                    pass.normal[y][x] = aov.normal;
+                                    pass.depth[y][x] = aov.depth;
+                                }
+                            }
+                        }
+                    }
+                });
+                return completed;
+            }));
+        }
+
+        auto completed = true;
+        for (auto& b : bands) {
+            completed = b.get() && completed;
+        }
+        pass.samples = 1;
+
+        return completed;
+    }
+
+    // Where a path picks up. Camera rays start at depth 0. A gather ray for the irradiance cache
+    // continues a path at 'depth', leaves whatever emission it finds first to the light sampling
+    // done where it started, and reports the distance to its first hit.
+    struct PathStart {
+        int depth = 0;
+        double path_length = 0;
+        bool gather = false;
+        double* first_distance = nullptr;
+    };
+
+    // Traces one path iteratively, carrying its throughput. 'scatter_pdf' is the density with
+    // which the previous vertex sampled the current ray, or 0 for the camera ray and specular
+    // bounces; emission found by a sampled ray is weighted against the light sampling done at
+    // that vertex (multiple importance sampling, power heuristic). The first hit is recorded in
+    // 'aov' when given. 'F' holds the RenderFeature bits the scene needs.
+    template <unsigned F>
+    Color ray_color(const Ray& camera_ray, const Hittable& world, const Hittable& lights,
+                    Sampler& sampler, SampleAov* aov = nullptr, PathStart start = {}) const {
+        Color radiance(0, 0, 0);
+        Color throughput(1, 1, 1);
+        Ray r = camera_ray;
+        double scatter_pdf = 0;
+        double path_length = start.path_length;
+
+        // with a photon map, light reached along diffuse -> specular -> light chains is already
+        // in the caustic estimate at the diffuse vertex: 'caustic_ray' marks rays on such chains
+        bool last_diffuse = start.gather;  // the last non-specular vertex was a diffuse surface
+        bool caustic_ray = false;
+
+        for (int depth = start.depth; depth < max_depth; ++depth) {
+            HitRecord rec;
+
+            if (!world.hit(r, Interval(0.001, infinity), rec)) {
+                if (!environment) {
+                    radiance += throughput * background;
+                } else if (!start.gather || depth > start.depth) {
+                    auto from_environment = environment->radiance(r.direction());
+                    if (scatter_pdf > 0) {
+                        auto light_pdf = environment_share * environment->pdf(r.direction());
+                        from_environment *= power_heuristic(scatter_pdf, light_pdf);
+                    }
+                    radiance += throughput * from_environment;
+                }
+                break;
+            }
+
+            // the pixel's ray cone, widened along the whole path, selects the texture filter width
+            path_length += rec.t * r.direction().length();
+            rec.footprint = rec.uv_per_unit * pixel_spread * path_length;
+
+            auto gather_hit = start.gather && depth == start.depth;
+            if (gather_hit && start.first_distance) {
+                *start.first_distance = rec.t * r.direction().length();
+            }
+
+            if (depth == 0 && aov) {
+                aov->albedo = rec.mat->base_color(rec);
+                aov->normal = rec.normal;
+                aov->depth = path_length;
+            }
+
+            // material evaluation and light sampling count as shading; the shadow rays traced by
+            // direct_light switch back to tracing
+            PhaseScope shading(Phase::shading);
+
+            if constexpr (has_feature(F, RenderFeature::emission)) {
+                Color from_emission = gather_hit || caustic_ray
+                                          ? Color(0, 0, 0)
+                                          : rec.mat->emitted(rec.u, rec.v, rec.p);
+
+                if (scatter_pdf > 0 && from_emission.length_squared() > 0) {
+                    auto light_pdf =
+                        (1 - environment_share) * lights.pdf_value(r.origin(), r.direction());
+                    from_emission *= power_heuristic(scatter_pdf, light_pdf);
+                }
+                radiance += throughput * from_emission;
+
+                if (caustics && rec.mat->is_diffuse()) {
+                    radiance += throughput * rec.mat->base_color(rec) *
+                                caustics->irradiance(rec.p, rec.normal) / pi;
+                }
+            }
+
+            auto dimension = first_bounce_dimension + depth * bounce_dimensions;
+
+            // the path ends at its first diffuse surface, with the direct light sampled as usual
+            // (and so not weighted against a bounce that never happens) and the rest cached
+            if (irradiance_cache && !start.gather && scatter_pdf == 0 && rec.mat->is_diffuse()) {
+                if constexpr (has_feature(F, RenderFeature::emission)) {
+                    sampler.set_dimension(dimension + light_dimension);
+                    radiance += throughput * direct_light<F>(r, rec, world, lights, sampler, false);
+                }
+                auto irradiance = cached_irradiance<F>(r, rec, world, lights, depth, path_length);
+                radiance += throughput * rec.mat->base_color(rec) * irradiance / pi;
+                break;
+            }
+
+            ScatterRecord srec;
+            sampler.set_dimension(dimension + bsdf_dimension);
+            if (!rec.mat->sample(r, rec, srec, sampler)) {
+                break;
+            }
+
+            // without emitters there is nothing for next-event estimation to find
+            if (has_feature(F, RenderFeature::emission) && !srec.is_specular) {
+                sampler.set_dimension(dimension + light_dimension);
+                radiance += throughput * direct_light<F>(r, rec, world, lights, sampler);
+            }
+
+            throughput = throughput * srec.weight;
+            r = srec.scattered;
+            scatter_pdf = srec.is_specular ? 0 : srec.pdf;
+            if (srec.is_specular) {
+                caustic_ray = caustics && last_diffuse;
+            } else {
+                last_diffuse = rec.mat->is_diffuse();
+                caustic_ray = false;
+            }
+
+            // Russian roulette: past the minimum depth, continue with a probability that follows
+            // the throughput and boost the survivors so the estimate stays unbiased.
+            if (depth + 1 >= russian_roulette_depth) {
+                auto survival =
+                    fmin(0.95, fmax(throughput.x(), fmax(throughput.y(), throughput.z())));
+                sampler.set_dimension(dimension + roulette_dimension);
+                if (sampler.get_1d() >= survival) {
+                    break;
+                }
+                throughput /= survival;
+            }
+        }
+
+        return radiance;
+    }
 
-        if (depth <= 0) {
+    // Next-event estimation: picks a direction towards one of the lights or the environment and
+    // returns the light it carries, attenuated by the transmittance of whatever lies in between
+    // and weighted by the material response, the light pdf and, if 'mis', the MIS weight against
+    // the material's own sampling.
+    template <unsigned F>
+    Color direct_light(const Ray& r_in, const HitRecord& rec, const Hittable& world,
+                       const Hittable& lights, Sampler& sampler, bool mis = true) const {
+        if (environment && sampler.get_1d() < environment_share) {
+            return environment_light<F>(r_in, rec, world, sampler, mis);
+        }
+
+        auto direction = unit_vector(lights.random(rec.p, sampler));
+        auto light_pdf = (1 - environment_share) * lights.pdf_value(rec.p, direction);
+        if (light_pdf <= 0) {
+            return Color(0, 0, 0);
+        }
+
+        Color f = rec.mat->eval(r_in, rec, direction);
+        if (f.length_squared() <= 0) {
+            return Color(0, 0, 0);
+        }
+
+        Ray to_light(rec.p, direction, r_in.time());
+        HitRecord light_rec;
+        double visibility;
+        {
+            PhaseScope tracing(Phase::tracing);
+            if (!lights.hit(to_light, Interval(0.001, infinity), light_rec)) {
+                return Color(0, 0, 0);
+            }
+            auto to_light_t = Interval(0.001, light_rec.t - 0.001);
+            if constexpr (has_feature(F, RenderFeature::volumes)) {
+                visibility = world.transmittance(to_light, to_light_t);
+            } else {
+                visibility = world.occluded(to_light, to_light_t) ? 0 : 1;
+            }
+        }
+        if (visibility <= 0) {
+            return Color(0, 0, 0);
+        }
+
+        auto weight = mis ? power_heuristic(light_pdf, rec.mat->pdf(r_in, rec, direction)) : 1;
+        return f * light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p) *
+               (visibility * weight / light_pdf);
+    }
+
+    // The environment's half of direct_light(): the shadow ray only has to escape the scene.
+    template <unsigned F>
+    Color environment_light(const Ray& r_in, const HitRecord& rec, const Hittable& world,
+                            Sampler& sampler, bool mis) const {
+        double light_pdf;
+        auto direction = environment->sample(sampler.get_2d(), light_pdf);
+        light_pdf *= environment_share;
+        if (light_pdf <= 0) {
+            return Color(0, 0, 0);
+        }
+
+        Color f = rec.mat->eval(r_in, rec, direction);
+        if (f.length_squared() <= 0) {
             return Color(0, 0, 0);
         }
 
-        if (!world.hit(r, Interval(0.001, infinity), rec)) {
-            return background;
+        Ray to_sky(rec.p, direction, r_in.time());
+        double visibility;
+        {
+            PhaseScope tracing(Phase::tracing);
+            auto to_sky_t = Interval(0.001, infinity);
+            if constexpr (has_feature(F, RenderFeature::volumes)) {
+                visibility = world.transmittance(to_sky, to_sky_t);
+            } else {
+                visibility = world.occluded(to_sky, to_sky_t) ? 0 : 1;
+            }
+        }
+        if (visibility <= 0) {
+            return Color(0, 0, 0);
         }
 
-        Ray scattered;
-        Color attenuation;
-        Color from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+        auto weight = mis ? power_heuristic(light_pdf, rec.mat->pdf(r_in, rec, direction)) : 1;
+        return f * environment->radiance(direction) * (visibility * weight / light_pdf);
+    }
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
-            return from_emission;
+    // Indirect irradiance at a diffuse hit, interpolated from the cache or, where no record is
+    // close enough, gathered with cosine-distributed paths and stored as a new record.
+    template <unsigned F>
+    Color cached_irradiance(const Ray& r_in, const HitRecord& rec, const Hittable& world,
+                            const Hittable& lights, int depth, double path_length) const {
+        auto& cache = *irradiance_cache;
+        Color irradiance;
+        if (cache.lookup(rec.p, rec.normal, irradiance)) {
+            return irradiance;
         }
 
-        Color from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+        Onb uvw;
+        uvw.build_from_w(rec.normal);
+        SobolSampler gather;
+        auto seed = static_cast<int>(cache.next_seed());
+        auto dimension = first_bounce_dimension + depth * bounce_dimensions;
+
+        Color sum(0, 0, 0);
+        double inverse_distances = 0;
+        for (int k = 0; k < cache.gather_rays; ++k) {
+            gather.start(seed, 0, k);
+            gather.set_dimension(dimension + bsdf_dimension);
+            auto [u1, u2] = gather.get_2d();
+            Ray ray(rec.p, uvw.local(sample_cosine_direction(u1, u2)), r_in.time());
+
+            auto distance = infinity;
+            sum += ray_color<F>(ray, world, lights, gather, nullptr,
+                                {depth + 1, path_length, true, &distance});
+            inverse_distances += 1 / distance;
+        }
+
+        // cosine-weighted directions make the irradiance pi times the mean radiance
+        IrradianceRecord record;
+        record.p = rec.p;
+        record.normal = rec.normal;
+        record.irradiance = sum * (pi / cache.gather_rays);
+        auto radius = inverse_distances > 0 ? cache.gather_rays / inverse_distances : infinity;
+        record.radius = cache.clamp_radius(radius, pixel_spread * path_length);
+        cache.insert(record);
+
+        return record.irradiance;
+    }
 
-        return from_emission + from_scatter;
+    static double power_heuristic(double pdf, double other_pdf) {
+        auto a = pdf * pdf;
+        return a / (a + other_pdf * other_pdf);
     }
 
-    Ray get_ray(int i, int j) const {
+    // The camera ray for the sample 'sampler' was started on.
+    template <unsigned F>
+    Ray get_ray(int i, int j, Sampler& sampler) const {
         auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-        auto pixel_sample = pixel_center + pixel_sample_square();
+        sampler.set_dimension(pixel_dimension);
+        auto pixel_sample = pixel_center + pixel_sample_square(sampler.get_2d());
 
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        auto ray_origin = center;
+        if constexpr (has_feature(F, RenderFeature::depth_of_field)) {
+            sampler.set_dimension(lens_dimension);
+            ray_origin = defocus_disk_sample(sampler.get_2d());
+        }
         auto ray_direction = pixel_sample - ray_origin;
-        double time = random_double();
+
+        double time = 0;
+        if constexpr (has_feature(F, RenderFeature::motion_blur)) {
+            sampler.set_dimension(time_dimension);
+            time = sampler.get_1d();
+        }
 
         return Ray(ray_origin, ray_direction, time);
     }
 
-    Vector3d pixel_sample_square() const {
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
+    Vector3d pixel_sample_square(const std::array<double, 2>& u) const {
+        auto px = -0.5 + u[0];
+        auto py = -0.5 + u[1];
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
-    Point3d defocus_disk_sample() const {
-        auto p = random_in_unit_disk();
+    Point3d defocus_disk_sample(const std::array<double, 2>& u) const {
+        auto p = sample_unit_disk(u[0], u[1]);
         return center + (p.x() * defocus_disk_u) + (p.y() * defocus_disk_v);
     }
 };
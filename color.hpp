@@ -2,14 +2,26 @@
 #define COLOR_H
 
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
 #include "rtweekend.hpp"
 
 using Color = Vector3d;
 
+// Perceived brightness of a linear color, with the Rec. 709 weights.
+inline double luminance(const Color &c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 inline constexpr double linear_to_gamma(double linear_component) { return sqrt(linear_component); }
 
+// Throws std::invalid_argument unless samples_per_pixel is positive.
 void write_color(std::ostream &out, const Color pixel_color, const double samples_per_pixel) {
+    if (!(samples_per_pixel > 0)) {
+        throw std::invalid_argument("cannot write a pixel of no samples");
+    }
+
     auto r = pixel_color.x();
     auto g = pixel_color.y();
     auto b = pixel_color.z();
@@ -30,4 +42,24 @@ void write_color(std::ostream &out, const Color pixel_color, const double sample
         << static_cast<int>(256 * intensity.clamp(b)) << "\n";
 }
 
+// Writes a plain PPM image from per-pixel sums of 'samples_per_pixel' samples. Throws
+// std::invalid_argument, before writing anything, unless samples_per_pixel is positive.
+inline void write_ppm(std::ostream &out, const std::vector<std::vector<Color>> &pixels,
+                      const double samples_per_pixel) {
+    if (!(samples_per_pixel > 0)) {
+        throw std::invalid_argument("cannot write an image of no samples");
+    }
+
+    auto height = pixels.size();
+    auto width = height > 0 ? pixels[0].size() : 0;
+
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+
+    for (const auto &row : pixels) {
+        for (const auto &pixel_color : row) {
+            write_color(out, pixel_color, samples_per_pixel);
+        }
+    }
+}
+
 #endif  // COLOR_H
\ No newline at end of file
@@ -18,46 +18,16 @@ public:
         const bool enableDebug = false;
         const bool debugging = enableDebug && random_double() < 0.00001;
 
-        HitRecord rec1, rec2;
-        if (!boundary->hit(r, Interval::universe, rec1)) {
+        double t;
+        if (!sample_scatter(r, ray_t, t)) {
             return false;
         }
 
-        if (!boundary->hit(r, Interval(rec1.t + 0.0001, infinity), rec2)) {
-            return false;
-        }
-
-        if (debugging) {
-            std::clog << "\nray_tmin=" << rec1.t << ", ray_tmax=" << rec2.t << "\n";
-        }
-
-        if (rec1.t < ray_t.min) {
-            rec1.t = ray_t.min;
-        }
-        if (rec2.t > ray_t.max) {
-            rec2.t = ray_t.max;
-        }
-        if (rec1.t >= rec2.t) {
-            return false;
-        }
-        if (rec1.t < 0) {
-            rec1.t = 0;
-        }
-
-        auto ray_length = r.direction().length();
-        auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        auto hit_distance = neg_inv_density * log(random_double());
-
-        if (hit_distance > distance_inside_boundary) {
-            return false;
-        }
-
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = t;
         rec.p = r.at(rec.t);
 
         if (debugging) {
-            std::clog << "hit_distance=" << hit_distance << "\n"
-                      << "rec.t=" << rec.t << "\n"
+            std::clog << "rec.t=" << rec.t << "\n"
                       << "rec.p=" << rec.p << "\n";
         }
 
@@ -68,12 +38,60 @@ public:
         return true;
     }
 
+    // A medium blocks a ray exactly when a scattering event is sampled inside it, so the any-hit
+    // answer is a stochastic (but unbiased) estimate of its transmittance.
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        double t;
+        return sample_scatter(r, ray_t, t);
+    }
+
+    // Homogeneous media attenuate shadow rays analytically (Beer-Lambert).
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        Interval span;
+        if (!boundary_span(r, ray_t, span)) {
+            return 1;
+        }
+
+        return exp((span.max - span.min) * r.direction().length() / neg_inv_density);
+    }
+
     Aabb bounding_box() const override { return boundary->bounding_box(); }
 
+    Aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+
 private:
     shared_ptr<Hittable> boundary;
     double neg_inv_density;
     shared_ptr<Material> phase_func;
+
+    // One entry/exit query over the whole line, clipped to the part of the ray being traced.
+    bool boundary_span(const Ray& r, Interval ray_t, Interval& span) const {
+        Interval crossings;
+        if (!boundary->hit_interval(r, Interval::universe, crossings)) {
+            return false;
+        }
+
+        span = Interval(fmax(fmax(crossings.min, ray_t.min), 0.0), fmin(crossings.max, ray_t.max));
+        return span.min < span.max;
+    }
+
+    bool sample_scatter(const Ray& r, Interval ray_t, double& t) const {
+        Interval span;
+        if (!boundary_span(r, ray_t, span)) {
+            return false;
+        }
+
+        auto ray_length = r.direction().length();
+        auto distance_inside_boundary = (span.max - span.min) * ray_length;
+        auto hit_distance = neg_inv_density * log(random_double());
+
+        if (hit_distance > distance_inside_boundary) {
+            return false;
+        }
+
+        t = span.min + hit_distance / ray_length;
+        return true;
+    }
 };
 
 #endif  // CONSTANT_MEDIUM_H
\ No newline at end of file
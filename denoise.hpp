@@ -0,0 +1,156 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "rtweekend.hpp"
+#include "trace.hpp"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the albedo, normal and
+// depth AOVs. The radiance is divided by the albedo before filtering so that texture detail is
+// kept, smoothed by successive 5x5 B3-spline passes with doubling hole spacing, and multiplied
+// back. Each pass is split into row bands processed in parallel.
+class Denoiser {
+public:
+    explicit Denoiser(int threads = 4) : threads(std::max(1, threads)) {}
+
+    int iterations = 5;
+    double sigma_color = 0.6;   // halved after every pass
+    double sigma_normal = 0.3;
+    double sigma_depth = 0.1;   // relative depth difference
+    double sigma_albedo = 0.1;
+    int threads;  // row bands filtered in parallel
+
+    // Returns the denoised radiance sums, on the same scale as fb.color. Throws
+    // std::invalid_argument if the frame has no samples to average.
+    std::vector<std::vector<Color>> denoise(const FrameBuffer& fb) const {
+        if (!(fb.samples > 0)) {
+            throw std::invalid_argument("cannot denoise an image with no samples");
+        }
+        auto w = fb.width, h = fb.height;
+        auto inv_samples = 1.0 / fb.samples;
+
+        Image albedo(h, std::vector<Color>(w)), normal(h, std::vector<Color>(w));
+        Image irradiance(h, std::vector<Color>(w));
+        std::vector<std::vector<double>> depth(h, std::vector<double>(w));
+
+        for (int j = 0; j < h; ++j) {
+            for (int i = 0; i < w; ++i) {
+                albedo[j][i] = fb.albedo[j][i] * inv_samples;
+                normal[j][i] = fb.normal[j][i] * inv_samples;
+                depth[j][i] = fb.depth[j][i] * inv_samples;
+                irradiance[j][i] = demodulate(fb.color[j][i] * inv_samples, albedo[j][i]);
+            }
+        }
+
+        auto sigma_c = sigma_color;
+        Image filtered(h, std::vector<Color>(w));
+
+        for (int pass = 0; pass < iterations; ++pass) {
+            auto step = 1 << pass;
+            auto band = (h + threads - 1) / threads;
+            TraceScope trace("denoise pass", pass);
+            std::vector<std::future<void>> bands;
+
+            for (int t = 0; t < threads; ++t) {
+                auto j0 = t * band, j1 = std::min(h, (t + 1) * band);
+                bands.push_back(std::async(std::launch::async, [&, j0, j1]() {
+                    Tracer::name_thread("denoise worker");
+                    TraceScope band_trace("denoise band", j0);
+                    for (int j = j0; j < j1; ++j) {
+                        for (int i = 0; i < w; ++i) {
+                            filtered[j][i] = filter_pixel(irradiance, albedo, normal, depth, i, j,
+                                                          step, sigma_c);
+                        }
+                    }
+                }));
+            }
+            for (auto& b : bands) {
+                b.get();
+            }
+
+            std::swap(irradiance, filtered);
+            sigma_c *= 0.5;
+        }
+
+        std::vector<std::vector<Color>> output(h, std::vector<Color>(w));
+        for (int j = 0; j < h; ++j) {
+            for (int i = 0; i < w; ++i) {
+                output[j][i] = remodulate(irradiance[j][i], albedo[j][i]) * fb.samples;
+            }
+        }
+
+        return output;
+    }
+
+private:
+    using Image = std::vector<std::vector<Color>>;
+
+    static constexpr double epsilon = 1e-3;
+
+    static Color demodulate(const Color& c, const Color& a) {
+        return Color(c.x() / (a.x() + epsilon), c.y() / (a.y() + epsilon),
+                     c.z() / (a.z() + epsilon));
+    }
+
+    static Color remodulate(const Color& c, const Color& a) {
+        return Color(c.x() * (a.x() + epsilon), c.y() * (a.y() + epsilon),
+                     c.z() * (a.z() + epsilon));
+    }
+
+    // Edge tests on HDR radiance use a Reinhard-compressed copy so that bright emitters do not
+    // dominate the color weight.
+    static Color compress(const Color& c) {
+        return Color(c.x() / (1 + c.x()), c.y() / (1 + c.y()), c.z() / (1 + c.z()));
+    }
+
+    Color filter_pixel(const Image& irradiance, const Image& albedo, const Image& normal,
+                       const std::vector<std::vector<double>>& depth, int i, int j, int step,
+                       double sigma_c) const {
+        static const double kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+        auto h = static_cast<int>(irradiance.size());
+        auto w = static_cast<int>(irradiance[0].size());
+
+        auto c_p = compress(irradiance[j][i]);
+        auto n_p = normal[j][i];
+        auto a_p = albedo[j][i];
+        auto d_p = depth[j][i];
+
+        Color sum(0, 0, 0);
+        auto weight_sum = 0.0;
+
+        for (int dy = -2; dy <= 2; ++dy) {
+            auto y = j + dy * step;
+            if (y < 0 || y >= h) continue;
+
+            for (int dx = -2; dx <= 2; ++dx) {
+                auto x = i + dx * step;
+                if (x < 0 || x >= w) continue;
+
+                auto c_q = irradiance[y][x];
+                auto dist_c = (compress(c_q) - c_p).length_squared();
+                auto dist_n = (normal[y][x] - n_p).length_squared();
+                auto dist_a = (albedo[y][x] - a_p).length_squared();
+                auto rel_d = fabs(depth[y][x] - d_p) / fmax(fmax(depth[y][x], d_p), 1e-6);
+
+                auto weight = kernel[dx + 2] * kernel[dy + 2] *
+                              exp(-dist_c / (sigma_c * sigma_c) -
+                                  dist_n / (sigma_normal * sigma_normal) -
+                                  dist_a / (sigma_albedo * sigma_albedo) -
+                                  rel_d * rel_d / (sigma_depth * sigma_depth));
+
+                sum += weight * c_q;
+                weight_sum += weight;
+            }
+        }
+
+        return weight_sum > 0 ? sum / weight_sum : irradiance[j][i];
+    }
+};
+
+#endif  // DENOISE_H
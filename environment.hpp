@@ -0,0 +1,159 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "color.hpp"
+#include "rtw_stb_image.hpp"
+#include "rtweekend.hpp"
+
+// Light arriving from infinitely far away, given by an equirectangular image: columns cover the
+// azimuth and rows run from straight up (the top row) to straight down. Texels are constant over
+// their patch of sphere, so the sampling density matches the radiance exactly.
+//
+// Directions are importance sampled in proportion to texel luminance times the solid angle the
+// texel covers, by a marginal distribution over rows and a conditional one within each row, so a
+// small bright sun is found by the light samples instead of by the few bounces that happen to hit
+// it.
+class EnvironmentMap {
+public:
+    // Loads 'filename' through stb_image as linear floats (HDR files as they are, 8-bit images
+    // converted from their gamma), searching the same places as image textures. Throws
+    // std::runtime_error if it cannot be loaded. 'scale' multiplies the radiance.
+    explicit EnvironmentMap(const std::string& filename, double scale = 1) {
+        auto path = RtwImage::find(filename.c_str());
+        int channels = 3;
+        auto data = path.empty() ? nullptr
+                                 : stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+        if (data == nullptr) {
+            throw std::runtime_error("could not load environment map '" + filename + "'");
+        }
+        texels.reserve(static_cast<size_t>(width) * height);
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i) {
+            texels.push_back(scale * Color(data[3 * i], data[3 * i + 1], data[3 * i + 2]));
+        }
+        STBI_FREE(data);
+
+        build_distributions();
+    }
+
+    // An image already in memory: 'texels' holds width * height colors, row by row from the top.
+    EnvironmentMap(int width, int height, std::vector<Color> texels)
+        : width(width), height(height), texels(std::move(texels)) {
+        if (width < 1 || height < 1 || this->texels.size() != static_cast<size_t>(width) * height) {
+            throw std::invalid_argument("environment map texels do not match its size");
+        }
+        build_distributions();
+    }
+
+    int image_width() const { return width; }
+    int image_height() const { return height; }
+
+    Color radiance(const Vector3d& direction) const {
+        auto [u, v] = image_coordinates(unit_vector(direction));
+        return texel(column(u), row(v));
+    }
+
+    // Picks a direction for the uniform sample 'u' and sets 'pdf' to its solid angle density.
+    Vector3d sample(const std::array<double, 2>& u, double& pdf) const {
+        auto j = pick(marginal, u[1]);
+        auto i = pick(conditional_row(j), u[0]);
+
+        // the remainder of each sample places the direction within the chosen texel
+        auto v = (j + remainder(marginal, j, u[1])) / height;
+        auto x = (i + remainder(conditional_row(j), i, u[0])) / width;
+
+        auto theta = v * pi, phi = x * 2 * pi;
+        auto sin_theta = sin(theta);
+        pdf = sin_theta > 0 ? texel_probability(i, j) * width * height / (2 * pi * pi * sin_theta)
+                            : 0;
+        return Vector3d(-sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+    }
+
+    // The solid angle density with which sample() picks 'direction'.
+    double pdf(const Vector3d& direction) const {
+        auto [u, v] = image_coordinates(unit_vector(direction));
+        auto sin_theta = sin(v * pi);
+        if (sin_theta <= 0) {
+            return 0;
+        }
+        return texel_probability(column(u), row(v)) * width * height / (2 * pi * pi * sin_theta);
+    }
+
+private:
+    int width = 0, height = 0;
+    std::vector<Color> texels;
+
+    // marginal[j] is the probability of the rows above j, ending in 1; conditional[j * (width +
+    // 1) + i] is the probability of the texels left of i within row j, also ending in 1
+    std::vector<double> marginal;
+    std::vector<double> conditional;
+
+    const Color& texel(int i, int j) const { return texels[static_cast<size_t>(j) * width + i]; }
+
+    // A texel row covers a band of the sphere whose area shrinks with sin(theta) towards the poles.
+    void build_distributions() {
+        marginal.assign(height + 1, 0);
+        conditional.assign(static_cast<size_t>(height) * (width + 1), 0);
+        for (int j = 0; j < height; ++j) {
+            auto sin_theta = sin((j + 0.5) / height * pi);
+            auto row_cdf = conditional.begin() + static_cast<size_t>(j) * (width + 1);
+            for (int i = 0; i < width; ++i) {
+                row_cdf[i + 1] = row_cdf[i] + std::max(0.0, luminance(texel(i, j))) * sin_theta;
+            }
+            marginal[j + 1] = marginal[j] + row_cdf[width];
+            normalize(row_cdf, width);
+        }
+        normalize(marginal.begin(), height);
+    }
+
+    // Turns running sums into a CDF; an all-black range becomes uniform.
+    static void normalize(std::vector<double>::iterator cdf, int n) {
+        auto total = cdf[n];
+        for (int i = 1; i <= n; ++i) {
+            cdf[i] = total > 0 ? cdf[i] / total : static_cast<double>(i) / n;
+        }
+    }
+
+    std::span<const double> conditional_row(int j) const {
+        return {conditional.data() + static_cast<size_t>(j) * (width + 1),
+                static_cast<size_t>(width) + 1};
+    }
+
+    // The bin of 'cdf' that 'u' falls in, skipping bins of zero probability.
+    static int pick(std::span<const double> cdf, double u) {
+        auto bin = std::upper_bound(cdf.begin() + 1, cdf.end(), u) - cdf.begin() - 1;
+        return static_cast<int>(std::min<ptrdiff_t>(bin, cdf.size() - 2));
+    }
+
+    static double remainder(std::span<const double> cdf, int bin, double u) {
+        auto p = cdf[bin + 1] - cdf[bin];
+        return p > 0 ? std::clamp((u - cdf[bin]) / p, 0.0, 1.0) : 0.5;
+    }
+
+    double texel_probability(int i, int j) const {
+        auto row = conditional_row(j);
+        return (marginal[j + 1] - marginal[j]) * (row[i + 1] - row[i]);
+    }
+
+    // The inverse of the mapping in sample(), with u across and v down the image.
+    static std::array<double, 2> image_coordinates(const Vector3d& d) {
+        auto theta = acos(std::clamp(d.y(), -1.0, 1.0));
+        auto phi = atan2(-d.z(), d.x()) + pi;
+        return {phi / (2 * pi), theta / pi};
+    }
+
+    int column(double u) const { return std::clamp(static_cast<int>(u * width), 0, width - 1); }
+
+    int row(double v) const { return std::clamp(static_cast<int>(v * height), 0, height - 1); }
+};
+
+#endif  // ENVIRONMENT_H
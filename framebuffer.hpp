@@ -0,0 +1,65 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+
+#include "color.hpp"
+#include "rtweekend.hpp"
+
+// First-hit auxiliary outputs of a single camera sample.
+struct SampleAov {
+    Color albedo = Color(1, 1, 1);
+    Vector3d normal;
+    double depth = 0;
+};
+
+// Output of a render: per-pixel sums of the radiance samples plus first-hit auxiliary outputs
+// (AOVs) summed over the same samples. 'albedo' is the base color of the first surface, 'normal'
+// its shading normal and 'depth' the distance to it; a miss contributes a white albedo, a zero
+// normal and zero depth.
+class FrameBuffer {
+public:
+    int width = 0, height = 0;
+    int samples = 0;  // samples per pixel accumulated into the sums
+    std::vector<std::vector<Color>> color;
+    std::vector<std::vector<Color>> albedo;
+    std::vector<std::vector<Vector3d>> normal;
+    std::vector<std::vector<double>> depth;
+
+    FrameBuffer() {}
+
+    FrameBuffer(int width, int height)
+        : width(width),
+          height(height),
+          color(height, std::vector<Color>(width, Color())),
+          albedo(height, std::vector<Color>(width, Color())),
+          normal(height, std::vector<Vector3d>(width, Vector3d())),
+          depth(height, std::vector<double>(width, 0.0)) {}
+
+    // Replaces rows [first, last) with zeroed storage allocated and first touched by the calling
+    // thread, so on a NUMA machine their pages sit on the node of the thread that fills them.
+    void localize_rows(int first, int last) {
+        for (int j = first; j < last; ++j) {
+            color[j] = std::vector<Color>(width, Color());
+            albedo[j] = std::vector<Color>(width, Color());
+            normal[j] = std::vector<Vector3d>(width, Vector3d());
+            depth[j] = std::vector<double>(width, 0.0);
+        }
+    }
+
+    // Merges a partial render of the same image, such as one produced by another thread.
+    FrameBuffer& operator+=(const FrameBuffer& other) {
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                color[j][i] += other.color[j][i];
+                albedo[j][i] += other.albedo[j][i];
+                normal[j][i] += other.normal[j][i];
+                depth[j][i] += other.depth[j][i];
+            }
+        }
+        samples += other.samples;
+        return *this;
+    }
+};
+
+#endif  // FRAMEBUFFER_H
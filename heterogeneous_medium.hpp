@@ -0,0 +1,134 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "rtweekend.hpp"
+#include "texture.hpp"
+#include "volume.hpp"
+
+// Participating medium whose density varies in space. Collisions are found by delta tracking
+// against a coarse majorant grid and shadow rays are attenuated by ratio tracking.
+class HeterogeneousMedium : public Hittable {
+public:
+    HeterogeneousMedium(shared_ptr<Hittable> b, shared_ptr<DensityGrid> grid, double density_scale,
+                        Color c, int majorant_resolution = 8)
+        : boundary(b),
+          grid(grid),
+          majorants(*grid, majorant_resolution),
+          density_scale(density_scale),
+          phase_func(make_shared<Isotropic>(c)) {}
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        double t;
+        if (!delta_track(r, ray_t, t)) {
+            return false;
+        }
+
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.normal = Vector3d(1, 0, 0);  // arbitrary
+        rec.front_face = true;           // arbitrary
+        rec.mat = phase_func;
+
+        return true;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        double t;
+        return delta_track(r, ray_t, t);
+    }
+
+    // Ratio tracking: every tentative collision scales the estimate by the probability that it
+    // is a null collision, instead of terminating the walk.
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        Interval span;
+        if (!boundary_span(r, ray_t, span)) {
+            return 1;
+        }
+
+        auto length = r.direction().length();
+        auto result = 1.0;
+
+        majorants.walk(r, span, [&](double t_enter, double t_exit, double majorant) {
+            auto sigma_bar = density_scale * majorant;
+            if (sigma_bar <= 0) {
+                return true;
+            }
+
+            auto t = t_enter;
+            while (true) {
+                t -= log(1 - random_double()) / (sigma_bar * length);
+                if (t >= t_exit) {
+                    return true;
+                }
+
+                result *= 1 - density_scale * grid->density(r.at(t)) / sigma_bar;
+                if (result <= 0) {
+                    result = 0;
+                    return false;
+                }
+            }
+        });
+
+        return result;
+    }
+
+    Aabb bounding_box() const override { return boundary->bounding_box(); }
+
+    Aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+
+private:
+    shared_ptr<Hittable> boundary;
+    shared_ptr<DensityGrid> grid;
+    MajorantGrid majorants;
+    double density_scale;
+    shared_ptr<Material> phase_func;
+
+    bool boundary_span(const Ray& r, Interval ray_t, Interval& span) const {
+        Interval crossings;
+        if (!boundary->hit_interval(r, Interval::universe, crossings)) {
+            return false;
+        }
+
+        span = Interval(fmax(fmax(crossings.min, ray_t.min), 0.0), fmin(crossings.max, ray_t.max));
+        return span.min < span.max;
+    }
+
+    // Delta tracking: tentative collisions are sampled with the cell majorant and accepted as
+    // real with probability density / majorant.
+    bool delta_track(const Ray& r, Interval ray_t, double& t_hit) const {
+        Interval span;
+        if (!boundary_span(r, ray_t, span)) {
+            return false;
+        }
+
+        auto length = r.direction().length();
+        auto found = false;
+
+        majorants.walk(r, span, [&](double t_enter, double t_exit, double majorant) {
+            auto sigma_bar = density_scale * majorant;
+            if (sigma_bar <= 0) {
+                return true;
+            }
+
+            auto t = t_enter;
+            while (true) {
+                t -= log(1 - random_double()) / (sigma_bar * length);
+                if (t >= t_exit) {
+                    return true;
+                }
+
+                if (random_double() * sigma_bar < density_scale * grid->density(r.at(t))) {
+                    t_hit = t;
+                    found = true;
+                    return false;
+                }
+            }
+        });
+
+        return found;
+    }
+};
+
+#endif  // HETEROGENEOUS_MEDIUM_H
@@ -3,6 +3,7 @@
 
 #include "aabb.hpp"
 #include "rtweekend.hpp"
+#include "sampler.hpp"
 
 class Material;
 
@@ -15,6 +16,8 @@ public:
     double u;
     double v;
     bool front_face;
+    double uv_per_unit = 0;  // texture-space size of one world unit on the surface
+    double footprint = 0;    // texture-space width of the ray cone at the hit, set by the camera
 
     void set_face_normal(const Ray& r, const Vector3d& outward_normal) {
         // Sets the HitRecord normal vector
@@ -28,7 +31,65 @@ class Hittable {
 public:
     virtual ~Hittable() = default;
     virtual bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const = 0;
+
+    // Any-hit query: true if anything blocks the ray within ray_t. Implementations may stop at
+    // the first intersection found and skip all surface-interaction work.
+    virtual bool occluded(const Ray& r, Interval ray_t) const = 0;
+
+    // Fraction of light that passes along the ray within ray_t. Opaque objects answer 0 or 1;
+    // participating media estimate it so that shadow rays are attenuated rather than cut off.
+    virtual double transmittance(const Ray& r, Interval ray_t) const {
+        return occluded(r, ray_t) ? 0.0 : 1.0;
+    }
+
+    // Entry/exit query: the range of ray parameters between the first and the last surface
+    // crossing within ray_t, found in a single pass. For the closed convex shapes that bound
+    // media these are exactly the entry and exit points. The fallback runs two closest-hit
+    // queries; primitives override it analytically.
+    virtual bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const {
+        HitRecord rec1, rec2;
+        if (!hit(r, ray_t, rec1)) {
+            return false;
+        }
+
+        span = Interval(rec1.t, rec1.t);
+        if (hit(r, Interval(rec1.t + 0.0001, ray_t.max), rec2)) {
+            span.max = rec2.t;
+        }
+
+        return true;
+    }
+
+    // Bounds over the whole shutter interval.
     virtual Aabb bounding_box() const = 0;
+
+    // Bounds at 'time' in [0, 1]. Moving objects override this; motion is linear, so the boxes at
+    // two times bound the object at every time in between when interpolated.
+    virtual Aabb bounding_box_at(double time) const { return bounding_box(); }
+
+    // Light sampling: the solid-angle density, as seen from 'origin', with which random() picks
+    // 'direction', and a direction from 'origin' towards the object drawn with values from
+    // 'sampler'. Only hittables that can be registered as lights need to override these.
+    virtual double pdf_value(const Point3d& origin, const Vector3d& direction) const { return 0.0; }
+
+    virtual Vector3d random(const Point3d& origin, Sampler& sampler) const {
+        return Vector3d(1, 0, 0);
+    }
+
+    // Emission sampling: a point picked uniformly by area with the values in 'u', returned in
+    // 'rec' with its outward normal, surface coordinates and material. Lights that photons can be
+    // emitted from override these; surface_area() is 0 for the others.
+    virtual double surface_area() const { return 0; }
+
+    virtual void sample_surface(const std::array<double, 2>& u, HitRecord& rec) const {}
+
+    // Bounds the surface normals for light sampling: each lies within the angle whose cosine is
+    // returned of 'axis' or of -axis, as lights emit from both faces. The default covers any
+    // surface.
+    virtual double normal_cone(Vector3d& axis) const {
+        axis = Vector3d(0, 0, 1);
+        return -1;
+    }
 };
 
 class Translate : public Hittable {
@@ -50,8 +111,33 @@ public:
         return true;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        return object->occluded(Ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        return object->transmittance(Ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        return object->hit_interval(Ray(r.origin() - offset, r.direction(), r.time()), ray_t,
+                                    span);
+    }
+
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        return object->pdf_value(origin - offset, direction);
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        return object->random(origin - offset, sampler);
+    }
+
     Aabb bounding_box() const override { return bbox; }
 
+    Aabb bounding_box_at(double time) const override {
+        return object->bounding_box_at(time) + offset;
+    }
+
 private:
     shared_ptr<Hittable> object;
     Vector3d offset;
@@ -64,41 +150,11 @@ public:
         auto radians = deg_to_rad(angle);
         sin_theta = sin(radians);
         cos_theta = cos(radians);
-        bbox = object->bounding_box();
-
-        Point3d min(infinity, infinity, infinity);
-        Point3d max(-infinity, -infinity, -infinity);
-
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                for (int k = 0; k < 2; k++) {
-                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-                    auto newx = cos_theta * x + sin_theta * z;
-                    auto newz = -sin_theta * x + cos_theta * z;
-
-                    min = Vector3d(fmin(min.x(), newx), fmin(min.y(), y), fmin(min.z(), newz));
-                    max = Vector3d(fmax(max.x(), newx), fmax(max.y(), y), fmax(max.z(), newz));
-                }
-            }
-        }
-
-        bbox = Aabb(min, max);
+        bbox = rotate(object->bounding_box());
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
-        auto origin =
-            Point3d(cos_theta * r.origin().x() - sin_theta * r.origin().z(), r.origin().y(),
-                    sin_theta * r.origin().x() + cos_theta * r.origin().z());
-        auto dir = Vector3d(cos_theta * r.direction().x() - sin_theta * r.direction().z(),
-                            r.direction().y(),
-                            sin_theta * r.direction().x() + cos_theta * r.direction().z());
-
-        Ray rotated_r(origin, dir, r.time());
-
-        if (!object->hit(rotated_r, ray_t, rec)) {
+        if (!object->hit(to_object(r), ray_t, rec)) {
             return false;
         }
 
@@ -114,13 +170,72 @@ public:
         return true;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        return object->occluded(to_object(r), ray_t);
+    }
+
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        return object->transmittance(to_object(r), ray_t);
+    }
+
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        return object->hit_interval(to_object(r), ray_t, span);
+    }
+
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        return object->pdf_value(to_object(origin), to_object(direction));
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        auto d = object->random(to_object(origin), sampler);
+        return Vector3d(cos_theta * d.x() + sin_theta * d.z(), d.y(),
+                        -sin_theta * d.x() + cos_theta * d.z());
+    }
+
     Aabb bounding_box() const override { return bbox; }
 
+    Aabb bounding_box_at(double time) const override {
+        return rotate(object->bounding_box_at(time));
+    }
+
 private:
     shared_ptr<Hittable> object;
     double sin_theta;
     double cos_theta;
     Aabb bbox;
+
+    // The world-space box around a rotated object-space box.
+    Aabb rotate(const Aabb& box) const {
+        Point3d min(infinity, infinity, infinity);
+        Point3d max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    auto x = i * box.x.max + (1 - i) * box.x.min;
+                    auto y = j * box.y.max + (1 - j) * box.y.min;
+                    auto z = k * box.z.max + (1 - k) * box.z.min;
+
+                    auto newx = cos_theta * x + sin_theta * z;
+                    auto newz = -sin_theta * x + cos_theta * z;
+
+                    min = Vector3d(fmin(min.x(), newx), fmin(min.y(), y), fmin(min.z(), newz));
+                    max = Vector3d(fmax(max.x(), newx), fmax(max.y(), y), fmax(max.z(), newz));
+                }
+            }
+        }
+
+        return Aabb(min, max);
+    }
+
+    Vector3d to_object(const Vector3d& p) const {
+        return Vector3d(cos_theta * p.x() - sin_theta * p.z(), p.y(),
+                        sin_theta * p.x() + cos_theta * p.z());
+    }
+
+    Ray to_object(const Ray& r) const {
+        return Ray(to_object(r.origin()), to_object(r.direction()), r.time());
+    }
 };
 
 #endif  // HITTABLE_H
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -41,8 +42,111 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    double transmittance(const Ray& r, Interval ray_t) const override {
+        auto result = 1.0;
+
+        for (const auto& object : objects) {
+            result *= object->transmittance(r, ray_t);
+            if (result <= 0) {
+                return 0;
+            }
+        }
+
+        return result;
+    }
+
+    // The hull of the members' crossings, so a box built from six quads yields its entry and
+    // exit in one pass over the sides.
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        Interval object_span;
+        bool hit_anything = false;
+        span = Interval::empty;
+
+        for (const auto& object : objects) {
+            if (object->hit_interval(r, ray_t, object_span)) {
+                hit_anything = true;
+                span = Interval(span, object_span);
+            }
+        }
+
+        return hit_anything;
+    }
+
     Aabb bounding_box() const override { return bbox; }
 
+    Aabb bounding_box_at(double time) const override {
+        Aabb box;
+        for (const auto& object : objects) {
+            box = Aabb(box, object->bounding_box_at(time));
+        }
+        return box;
+    }
+
+    // Lights in a list are sampled uniformly, so the density is the average of their densities.
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        if (objects.empty()) {
+            return 0.0;
+        }
+
+        auto weight = 1.0 / objects.size();
+        auto sum = 0.0;
+
+        for (const auto& object : objects) {
+            sum += weight * object->pdf_value(origin, direction);
+        }
+
+        return sum;
+    }
+
+    double surface_area() const override {
+        auto area = 0.0;
+        for (const auto& object : objects) {
+            area += object->surface_area();
+        }
+        return area;
+    }
+
+    // Picks a member by area with u[0], rescaled to pick the point on it.
+    void sample_surface(const std::array<double, 2>& u, HitRecord& rec) const override {
+        auto remaining = u[0] * surface_area();
+        const Hittable* last = nullptr;  // takes what rounding leaves past the end
+        for (const auto& object : objects) {
+            auto area = object->surface_area();
+            if (area <= 0) {
+                continue;
+            }
+            if (remaining < area) {
+                object->sample_surface({remaining / area, u[1]}, rec);
+                return;
+            }
+            remaining -= area;
+            last = object.get();
+        }
+        if (last) {
+            last->sample_surface({1, u[1]}, rec);
+        }
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        if (objects.empty()) {
+            return Vector3d(1, 0, 0);
+        }
+
+        auto int_size = static_cast<int>(objects.size());
+        auto pick = std::min(static_cast<int>(sampler.get_1d() * int_size), int_size - 1);
+        return objects[pick]->random(origin, sampler);
+    }
+
 private:
     Aabb bbox;
 };
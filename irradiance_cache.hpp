@@ -0,0 +1,169 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "color.hpp"
+#include "rtweekend.hpp"
+#include "sampler.hpp"
+
+// Indirect irradiance gathered at one surface point. 'radius' is the harmonic mean distance to the
+// surfaces the gather rays hit: the closer the surroundings, the faster the irradiance changes.
+class IrradianceRecord {
+public:
+    Point3d p;
+    Vector3d normal;
+    Color irradiance;
+    double radius;
+};
+
+// Ward-style irradiance cache. Records are computed sparsely by whoever first needs one, and a
+// point whose estimated interpolation error against nearby records stays below 'error' is shaded
+// from them instead. The error of record i at (p, n) is
+//
+//     |p - p_i| / R_i + sqrt(1 - n . n_i)
+//
+// and records are blended with weight 1 - error_i / error, which fades each one out smoothly at
+// the edge of its validity. Records live in hashed grids, one per power-of-two size of their
+// validity sphere, so a lookup reads a single cell per size in use. The cells are split over
+// lock stripes; lookups only take shared locks, so render threads rarely wait for one another.
+class IrradianceCache {
+public:
+    explicit IrradianceCache(double error = 0.25, int gather_rays = 256)
+        : error(error), gather_rays(gather_rays) {}
+
+    double error;
+    int gather_rays;  // hemisphere samples per record
+
+    // Bounds on the validity radius of a record, error * R, in pixels at the record's distance, so
+    // that records neither get so dense that they cost as much as path tracing nor so sparse that
+    // they blur over geometry the gather rays happened to miss.
+    double min_spacing = 2;
+    double max_spacing = 32;
+
+    // Interpolates the irradiance at 'p' with surface normal 'normal'. Returns false if no record
+    // is valid there.
+    bool lookup(const Point3d& p, const Vector3d& normal, Color& irradiance) const {
+        Color sum(0, 0, 0);
+        double weight_sum = 0;
+
+        auto levels = used_levels.load(std::memory_order_acquire);
+        while (levels != 0) {
+            auto level = std::countr_zero(levels) + min_level;
+            levels &= levels - 1;
+
+            auto key = cell_key(level, cell(p, level, 0), cell(p, level, 1), cell(p, level, 2));
+            const auto& stripe = stripes[key % stripe_count];
+            std::shared_lock lock(stripe.mutex);
+            auto found = stripe.cells.find(key);
+            if (found == stripe.cells.end()) {
+                continue;
+            }
+
+            for (const auto& record : found->second) {
+                auto offset = p - record.p;
+                auto distance_squared = offset.length_squared();
+                auto reach = error * record.radius;
+                if (distance_squared >= reach * reach) {
+                    continue;
+                }
+                auto e = sqrt(distance_squared) / record.radius +
+                         sqrt(fmax(0.0, 1 - dot(normal, record.normal)));
+                if (e >= error) {
+                    continue;
+                }
+                // a record in front of 'p' sees surroundings that 'p' may not
+                if (dot(offset, normal + record.normal) < -0.02 * record.radius) {
+                    continue;
+                }
+                auto weight = 1 - e / error;
+                sum += weight * record.irradiance;
+                weight_sum += weight;
+            }
+        }
+
+        if (weight_sum <= 0) {
+            return false;
+        }
+        irradiance = sum / weight_sum;
+        return true;
+    }
+
+    // Adds a record whose radius has already been clamped with clamp_radius().
+    void insert(const IrradianceRecord& record) {
+        auto reach = error * record.radius;
+        auto level = std::clamp(static_cast<int>(std::ceil(std::log2(reach))), min_level,
+                                max_level);
+        int64_t lo[3], hi[3];
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = cell(record.p, level, a, -reach);
+            hi[a] = cell(record.p, level, a, reach);
+        }
+
+        for (auto x = lo[0]; x <= hi[0]; ++x) {
+            for (auto y = lo[1]; y <= hi[1]; ++y) {
+                for (auto z = lo[2]; z <= hi[2]; ++z) {
+                    auto key = cell_key(level, x, y, z);
+                    auto& stripe = stripes[key % stripe_count];
+                    std::unique_lock lock(stripe.mutex);
+                    stripe.cells[key].push_back(record);
+                }
+            }
+        }
+
+        used_levels.fetch_or(uint64_t(1) << (level - min_level), std::memory_order_release);
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Clamps a harmonic mean distance so the record's validity radius spans min_spacing to
+    // max_spacing pixels of size 'pixel_size'.
+    double clamp_radius(double radius, double pixel_size) const {
+        return std::clamp(radius, min_spacing * pixel_size / error,
+                          max_spacing * pixel_size / error);
+    }
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+    // A distinct value per call, for decorrelating the gather rays of different records.
+    uint32_t next_seed() { return seeds.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    static constexpr int min_level = -32;  // cells are 2^level units wide, 64 sizes in all
+    static constexpr int max_level = 31;
+    static constexpr size_t stripe_count = 64;
+
+    struct Stripe {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint64_t, std::vector<IrradianceRecord>> cells;
+    };
+
+    std::array<Stripe, stripe_count> stripes;
+    std::atomic<uint64_t> used_levels = 0;
+    std::atomic<size_t> count = 0;
+    std::atomic<uint32_t> seeds = 0;
+
+    static int64_t cell(const Point3d& p, int level, int axis, double offset = 0) {
+        return static_cast<int64_t>(std::floor(std::ldexp(p[axis] + offset, -level)));
+    }
+
+    // Distinct cells may share a key; lookups test every record's distance anyway.
+    static uint64_t cell_key(int level, int64_t x, int64_t y, int64_t z) {
+        auto h = hash_u32(static_cast<uint32_t>(level));
+        for (auto c : {x, y, z}) {
+            h = hash_combine(h, static_cast<uint32_t>(c));
+            h = hash_combine(h, static_cast<uint32_t>(c >> 32));
+        }
+        return (uint64_t(hash_u32(h ^ 0x9e3779b9u)) << 32) | h;
+    }
+};
+
+#endif  // IRRADIANCE_CACHE_H
@@ -0,0 +1,307 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "aabb.hpp"
+#include "color.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "rtweekend.hpp"
+
+// The lights of a scene in a hierarchy for next-event estimation, a drop-in for the HittableList
+// of lights. Every node bounds its lights' extent, the cone their normals lie in and their total
+// power. Sampling walks from the root choosing between the two children in proportion to an
+// estimate of how much each could contribute at the shading point, so one light is picked in
+// O(log n) steps, and mostly one that is close, bright and facing the point. pdf_value() follows
+// the ray down the same tree and multiplies the probabilities of the choices leading to the
+// lights it meets, so the density stays exact for multiple importance sampling.
+//
+// The estimate follows Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive
+// Tree Splitting": power over squared distance, times the cosine of the smallest angle at which a
+// normal in the cone could face the point. It never rules out a light that can reach the point.
+class LightBvh : public Hittable {
+public:
+    LightBvh() {}
+
+    explicit LightBvh(const HittableList& lights) : lights(lights.objects) {
+        if (this->lights.empty()) {
+            return;
+        }
+
+        std::vector<Bounds> items;
+        std::vector<int> order;
+        for (const auto& light : this->lights) {
+            items.push_back(light_bounds(*light));
+            order.push_back(static_cast<int>(order.size()));
+        }
+        nodes.reserve(2 * order.size() - 1);
+        build(items, order, 0, order.size());
+    }
+
+    size_t size() const { return lights.size(); }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        auto hit_anything = false;
+        visit(r, ray_t, [&](const Hittable& light) {
+            if (light.hit(r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+            return false;
+        });
+        return hit_anything;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        auto blocked = false;
+        visit(r, ray_t, [&](const Hittable& light) {
+            blocked = light.occluded(r, ray_t);
+            return blocked;
+        });
+        return blocked;
+    }
+
+    Aabb bounding_box() const override { return nodes.empty() ? Aabb() : nodes[0].bounds.box; }
+
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        if (nodes.empty()) {
+            return 0.0;
+        }
+        return pdf_below(0, Ray(origin, direction, 0), 1.0);
+    }
+
+    // Takes one value from 'sampler' for the walk down the tree, as HittableList does to pick a
+    // light, and rescales it at every step.
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        if (nodes.empty()) {
+            return Vector3d(1, 0, 0);
+        }
+
+        auto u = sampler.get_1d();
+        int i = 0;
+        while (nodes[i].light < 0) {
+            auto p = left_probability(i, origin);
+            if (u < p) {
+                u /= p;
+                i = i + 1;
+            } else {
+                u = std::min((u - p) / (1 - p), 1.0);
+                i = nodes[i].right;
+            }
+        }
+        return lights[nodes[i].light]->random(origin, sampler);
+    }
+
+private:
+    struct Bounds {
+        Aabb box;
+        Vector3d axis;      // normals lie within the cone about axis or -axis
+        double cos_spread;  // of the cone's half-angle
+        double power;
+    };
+
+    // Nodes are stored depth first: a node's left child follows it and 'right' indexes the other.
+    struct Node {
+        Bounds bounds;
+        int right = -1;
+        int light = -1;  // leaves only
+    };
+
+    std::vector<shared_ptr<Hittable>> lights;
+    std::vector<Node> nodes;
+
+    // Lights that cannot sample their surface get the power of a unit emitter over half their box.
+    static Bounds light_bounds(const Hittable& light) {
+        Bounds b;
+        b.box = light.bounding_box();
+        b.cos_spread = light.normal_cone(b.axis);
+
+        auto area = light.surface_area();
+        if (area > 0) {
+            HitRecord rec;
+            light.sample_surface({0.5, 0.5}, rec);
+            b.power = area * luminance(rec.mat->emitted(rec.u, rec.v, rec.p));
+        } else {
+            b.power = b.box.surface_area() / 2;
+        }
+        b.power = std::max(b.power, 0.0);
+        return b;
+    }
+
+    static Point3d centroid(const Aabb& box) {
+        return Point3d(box.x.min + box.x.max, box.y.min + box.y.max, box.z.min + box.z.max) / 2;
+    }
+
+    // The smallest double cone holding both cones.
+    static void merge_cones(const Bounds& a, const Bounds& b, Bounds& out) {
+        if (a.cos_spread <= -1 || b.cos_spread <= -1) {
+            out.axis = a.axis;
+            out.cos_spread = -1;
+            return;
+        }
+        auto b_axis = dot(a.axis, b.axis) < 0 ? -b.axis : b.axis;
+        auto theta_a = acos(std::clamp(a.cos_spread, -1.0, 1.0));
+        auto theta_b = acos(std::clamp(b.cos_spread, -1.0, 1.0));
+        auto theta_d = acos(std::clamp(dot(a.axis, b_axis), -1.0, 1.0));
+
+        if (std::min(theta_d + theta_b, pi) <= theta_a) {
+            out.axis = a.axis;
+            out.cos_spread = a.cos_spread;
+            return;
+        }
+        if (std::min(theta_d + theta_a, pi) <= theta_b) {
+            out.axis = b_axis;
+            out.cos_spread = b.cos_spread;
+            return;
+        }
+
+        auto theta_o = (theta_a + theta_d + theta_b) / 2;
+        auto turn = cross(a.axis, b_axis);
+        if (theta_o >= pi || turn.length_squared() <= 0) {
+            out.axis = a.axis;
+            out.cos_spread = -1;
+            return;
+        }
+
+        // rotate a's axis towards b's by theta_o - theta_a (Rodrigues' formula)
+        auto k = unit_vector(turn);
+        auto angle = theta_o - theta_a;
+        out.axis = unit_vector(a.axis * cos(angle) + cross(k, a.axis) * sin(angle) +
+                               k * dot(k, a.axis) * (1 - cos(angle)));
+        out.cos_spread = cos(theta_o);
+    }
+
+    int build(const std::vector<Bounds>& items, std::vector<int>& order, size_t start,
+              size_t end) {
+        auto index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+
+        if (end - start == 1) {
+            nodes[index].bounds = items[order[start]];
+            nodes[index].light = order[start];
+            return index;
+        }
+
+        // median split along the longest axis of the lights' centers
+        Aabb centers;
+        for (auto i = start; i < end; ++i) {
+            auto c = centroid(items[order[i]].box);
+            centers = Aabb(centers, Aabb(c, c));
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; ++a) {
+            if (centers.axis(a).size() > centers.axis(axis).size()) {
+                axis = a;
+            }
+        }
+        auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) {
+                             return centroid(items[a].box)[axis] < centroid(items[b].box)[axis];
+                         });
+
+        build(items, order, start, mid);
+        auto right = build(items, order, mid, end);
+
+        const auto& l = nodes[index + 1].bounds;
+        const auto& r = nodes[right].bounds;
+        Bounds merged;
+        merged.box = Aabb(l.box, r.box);
+        merged.power = l.power + r.power;
+        merge_cones(l, r, merged);
+        nodes[index].bounds = merged;
+        nodes[index].right = right;
+        return index;
+    }
+
+    // Power over squared distance, times the cosine of the angle between the direction to 'p'
+    // and the nearest normal in the cone, less the angle the bounds subtend from 'p'.
+    static double importance(const Bounds& b, const Point3d& p) {
+        auto center = centroid(b.box);
+        auto half_diagonal_squared =
+            (Point3d(b.box.x.max, b.box.y.max, b.box.z.max) - center).length_squared();
+        auto offset = p - center;
+        auto distance_squared = offset.length_squared();
+        if (distance_squared <= half_diagonal_squared) {
+            return b.power / std::max(half_diagonal_squared, 1e-12);
+        }
+
+        // cosine and sine of the angle a - b clamped at zero, from those of a and b
+        auto cos_sub = [](double sin_a, double cos_a, double sin_b, double cos_b) {
+            return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+        };
+        auto sin_sub = [](double sin_a, double cos_a, double sin_b, double cos_b) {
+            return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+        };
+        auto sin_of = [](double c) { return sqrt(std::max(0.0, 1 - c * c)); };
+
+        auto cos_w = fabs(dot(b.axis, offset)) / sqrt(distance_squared);
+        auto cos_b = sqrt(1 - half_diagonal_squared / distance_squared);
+        auto cos_x = cos_sub(sin_of(cos_w), cos_w, sin_of(b.cos_spread), b.cos_spread);
+        auto sin_x = sin_sub(sin_of(cos_w), cos_w, sin_of(b.cos_spread), b.cos_spread);
+        auto cos_p = cos_sub(sin_x, cos_x, sin_of(cos_b), cos_b);
+        if (cos_p <= 0) {
+            return 0;
+        }
+        return b.power * cos_p / distance_squared;
+    }
+
+    // The probability of taking node i's left child from 'p'; even if neither side can reach it.
+    double left_probability(int i, const Point3d& p) const {
+        auto left = importance(nodes[i + 1].bounds, p);
+        auto right = importance(nodes[nodes[i].right].bounds, p);
+        return left + right > 0 ? left / (left + right) : 0.5;
+    }
+
+    double pdf_below(int i, const Ray& r, double probability) const {
+        const auto& node = nodes[i];
+        if (!node.bounds.box.hit(r, Interval(0.001, infinity))) {
+            return 0;
+        }
+        if (node.light >= 0) {
+            return probability * lights[node.light]->pdf_value(r.origin(), r.direction());
+        }
+
+        auto p = left_probability(i, r.origin());
+        auto sum = 0.0;
+        if (p > 0) {
+            sum += pdf_below(i + 1, r, probability * p);
+        }
+        if (p < 1) {
+            sum += pdf_below(node.right, r, probability * (1 - p));
+        }
+        return sum;
+    }
+
+    // Calls 'found' on the lights whose boxes the ray crosses within ray_t, which it may shorten,
+    // until 'found' returns true.
+    template <typename Found>
+    void visit(const Ray& r, Interval& ray_t, const Found& found) const {
+        if (nodes.empty()) {
+            return;
+        }
+        int stack[64];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0) {
+            const auto& node = nodes[stack[--depth]];
+            if (!node.bounds.box.hit(r, ray_t)) {
+                continue;
+            }
+            if (node.light >= 0) {
+                if (found(*lights[node.light])) {
+                    return;
+                }
+                continue;
+            }
+            stack[depth++] = node.right;
+            stack[depth++] = static_cast<int>(&node - nodes.data()) + 1;
+        }
+    }
+};
+
+#endif  // LIGHT_BVH_H
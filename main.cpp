@@ -1,416 +1,442 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <future>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
-#include "bvh.hpp"
 #include "camera.hpp"
 #include "color.hpp"
-#include "constant_medium.hpp"
+#include "denoise.hpp"
 #include "hittable_list.hpp"
-#include "material.hpp"
-#include "quad.hpp"
+#include "light_bvh.hpp"
+#include "multi_view.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "render_server.hpp"
 #include "rtweekend.hpp"
-#include "sphere.hpp"
-#include "texture.hpp"
+#include "scene_io.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
 
-std::vector<std::vector<Color>> render(const Hittable& world, Camera cam) {
-    return cam.render(world);
+FrameBuffer render(const Hittable& world, const Hittable& lights, Camera cam) {
+    return cam.render(world, lights);
 }
 
-void random_spheres(HittableList& world, Camera& cam) {
-    auto checker = make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-    world.add(make_shared<Sphere>(Point3d(0, -1000, 0), 1000, make_shared<Lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            Point3d center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - Point3d(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<Material> mat_sphere;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = Color::random() * Color::random();
-                    mat_sphere = make_shared<Lambertian>(albedo);
-                    auto center2 = center + Vector3d(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<Sphere>(center, center2, 0.2, mat_sphere));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = Color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    mat_sphere = make_shared<Metal>(albedo, fuzz);
-                    world.add(make_shared<Sphere>(center, 0.2, mat_sphere));
-                } else {
-                    // glass
-                    mat_sphere = make_shared<Dielectric>(1.5);
-                    world.add(make_shared<Sphere>(center, 0.2, mat_sphere));
-                }
-            }
-        }
+void write_image(std::ostream& out, const FrameBuffer& image, bool denoise, int threads) {
+    PhaseScope output(Phase::output);
+    std::vector<std::vector<Color>> pixels;
+    if (denoise) {
+        TraceScope trace("denoise");
+        pixels = Denoiser(threads).denoise(image);
+    } else {
+        pixels = image.color;
     }
 
-    auto material1 = make_shared<Dielectric>(1.5);
-    world.add(make_shared<Sphere>(Point3d(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(make_shared<Sphere>(Point3d(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<Sphere>(Point3d(4, 1, 0), 1.0, material3));
-
-    world = HittableList(std::make_shared<BvhNode>(world));
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.look_from = Point3d(13, 2, 3);
-    cam.look_at = Point3d(0, 0, 0);
-    cam.v_up = Point3d(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-}
-
-void two_spheres(HittableList& world, Camera& cam) {
-    auto checker = make_shared<CheckerTexture>(0.8, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-
-    world.add(make_shared<Sphere>(Point3d(0, -10, 0), 10, make_shared<Lambertian>(checker)));
-    world.add(make_shared<Sphere>(Point3d(0, 10, 0), 10, make_shared<Lambertian>(checker)));
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.look_from = Point3d(13, 2, 3);
-    cam.look_at = Point3d(0, 0, 0);
-    cam.v_up = Point3d(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-}
-
-void earth(HittableList& world, Camera& cam) {
-    auto earth_texture = make_shared<ImageTexture>("earthmap.jpg");
-    auto earth_surface = make_shared<Lambertian>(earth_texture);
-    auto globe = make_shared<Sphere>(Point3d(0, 0, 0), 2, earth_surface);
-
-    world.add(globe);
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.look_from = Point3d(13, 2, 3);
-    cam.look_at = Point3d(0, 0, 0);
-    cam.v_up = Point3d(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
+    TraceScope trace("write image");
+    write_ppm(out, pixels, image.samples);
 }
 
-void two_perlin_spheres(HittableList& world, Camera& cam) {
-    auto pertext = make_shared<NoiseTexture>(4);
-    world.add(make_shared<Sphere>(Point3d(0, -1000, 0), 1000, make_shared<Lambertian>(pertext)));
-    world.add(make_shared<Sphere>(Point3d(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.look_from = Point3d(13, 2, 3);
-    cam.look_at = Point3d(0, 0, 0);
-    cam.v_up = Point3d(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
+void write_reports(const std::string& perf_path, const std::string& trace_path) {
+    if (!perf_path.empty()) {
+        std::ofstream json(perf_path);
+        PerfCounters::instance().report(std::clog, json);
+    }
+    if (!trace_path.empty()) {
+        std::ofstream trace(trace_path);
+        Tracer::instance().write(trace);
+    }
 }
 
-void quads(HittableList& world, Camera& cam) {
-    auto left_red = make_shared<Lambertian>(Color(1, 0.2, 0.2));
-    auto back_green = make_shared<Lambertian>(Color(0.2, 1, 0.2));
-    auto right_blue = make_shared<Lambertian>(Color(0.2, 0.2, 1));
-    auto upper_orange = make_shared<Lambertian>(Color(1, 0.5, 0));
-    auto lower_teal = make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
-
-    world.add(
-        make_shared<Quad>(Point3d(-3, -2, 5), Vector3d(0, 0, -4), Vector3d(0, 4, 0), left_red));
-    world.add(
-        make_shared<Quad>(Point3d(-2, -2, 0), Vector3d(4, 0, 0), Vector3d(0, 4, 0), back_green));
-    world.add(
-        make_shared<Quad>(Point3d(3, -2, 1), Vector3d(0, 0, 4), Vector3d(0, 4, 0), right_blue));
-    world.add(
-        make_shared<Quad>(Point3d(-2, 3, 1), Vector3d(4, 0, 0), Vector3d(0, 0, 4), upper_orange));
-    world.add(
-        make_shared<Quad>(Point3d(-2, -3, 5), Vector3d(4, 0, 0), Vector3d(0, 0, -4), lower_teal));
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0.7, 0.8, 1);
-
-    cam.vfov = 80;
-    cam.look_from = Point3d(0, 0, 9);
-    cam.look_at = Point3d(0, 0, 0);
-    cam.v_up = Vector3d(0, 1, 0);
-
-    cam.defocus_angle = 0;
+void usage() {
+    std::cerr << "usage: raytracing [scene] [options] > image.ppm\n"
+                 "  scene               built-in scene name or scene file (default final_scene)\n"
+                 "  --export <file>     write the scene out instead of rendering it; files\n"
+                 "                      ending in .rtws are binary, anything else is text\n"
+                 "  --width <pixels>    override the image width\n"
+                 "  --spp <samples>     override the samples per pixel\n"
+                 "  --depth <bounces>   override the maximum path depth\n"
+                 "  --time-budget <s>   render progressively for at most this many seconds\n"
+                 "  --preview <file>    with --time-budget, keep <file> updated with the image\n"
+                 "                      so far\n"
+                 "  --sampler <name>    independent, stratified, sobol (default) or blue_noise\n"
+                 "  --numa <policy>     off (default), pin workers to CPUs spread over the NUMA\n"
+                 "                      nodes, or replicate the scene on every node as well\n"
+                 "  --irradiance-cache <error>\n"
+                 "                      interpolate diffuse indirect light from a cache of\n"
+                 "                      sparse samples, allowing this error (e.g. 0.2)\n"
+                 "  --caustics <photons>\n"
+                 "                      trace this many photons from the lights and render\n"
+                 "                      caustics from the resulting photon map\n"
+                 "  --environment <image>\n"
+                 "                      light the scene with an equirectangular (HDR) image in\n"
+                 "                      place of its background color\n"
+                 "  --views <file>      render every view listed in <file> into its own image,\n"
+                 "                      sharing one scene build and one thread pool; each line\n"
+                 "                      is '<image.ppm> <look_from xyz> <look_at xyz> [vfov]'\n"
+                 "  --denoise           filter the result with the AOV-guided denoiser\n"
+                 "  --perf <file>       count cycles, cache and branch misses per render phase;\n"
+                 "                      prints a table and writes the totals to <file> as JSON\n"
+                 "  --trace <file>      write a Chrome trace of the render timeline to <file>\n"
+                 "  --serve <socket>    keep scenes loaded and render jobs sent to this UNIX\n"
+                 "                      socket until a client sends 'shutdown'; jobs bring\n"
+                 "                      their own scene and settings, apart from --sampler\n"
+                 "built-in scenes:";
+    for (const auto& name : builtin_scene_names()) {
+        std::cerr << ' ' << name;
+    }
+    std::cerr << '\n';
 }
 
-void simple_light(HittableList& world, Camera& cam) {
-    auto pertext = make_shared<NoiseTexture>(4);
-    world.add(make_shared<Sphere>(Point3d(0, -1000, 0), 1000, make_shared<Lambertian>(pertext)));
-    world.add(make_shared<Sphere>(Point3d(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
-
-    auto difflight = make_shared<DiffuseLight>(Color(4, 4, 4));
-    world.add(
-        make_shared<Quad>(Point3d(3, 1, -2), Vector3d(2, 0, 0), Vector3d(0, 2, 0), difflight));
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = Color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.look_from = Point3d(26, 3, 6);
-    cam.look_at = Point3d(0, 2, 0);
-    cam.v_up = Vector3d(0, 1, 0);
+int main(int argc, char** argv) {
+    std::string scene_name = "final_scene";
+    bool scene_given = false;
+    std::string export_path;
+    std::string perf_path;
+    std::string trace_path;
+    std::string serve_path;
+    std::string environment_path;
+    std::string views_path;
+    std::string preview_path;
+    int width = 0, spp = 0, depth = 0;
+    bool DENOISE = false;
+    bool PROGRESSIVE = false;
+    double TIME_BUDGET = 60;  // seconds, progressive mode only
+    SamplerType SAMPLER = SamplerType::sobol;
+    NumaPolicy NUMA = NumaPolicy::off;
+    double IRRADIANCE_ERROR = 0;  // 0 traces every path in full
+    int CAUSTIC_PHOTONS = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(arg + " needs a value");
+            }
+            return argv[++i];
+        };
+
+        try {
+            if (arg == "--export") {
+                export_path = value();
+            } else if (arg == "--width") {
+                width = std::stoi(value());
+            } else if (arg == "--spp") {
+                spp = std::stoi(value());
+            } else if (arg == "--depth") {
+                depth = std::stoi(value());
+            } else if (arg == "--time-budget") {
+                PROGRESSIVE = true;
+                TIME_BUDGET = std::stod(value());
+            } else if (arg == "--preview") {
+                preview_path = value();
+            } else if (arg == "--sampler") {
+                if (!parse_sampler(value(), SAMPLER)) {
+                    throw std::invalid_argument("unknown sampler " + std::string(argv[i]));
+                }
+            } else if (arg == "--numa") {
+                if (!parse_numa_policy(value(), NUMA)) {
+                    throw std::invalid_argument("unknown NUMA policy " + std::string(argv[i]));
+                }
+            } else if (arg == "--irradiance-cache") {
+                IRRADIANCE_ERROR = std::stod(value());
+            } else if (arg == "--caustics") {
+                CAUSTIC_PHOTONS = std::stoi(value());
+            } else if (arg == "--environment") {
+                environment_path = value();
+            } else if (arg == "--views") {
+                views_path = value();
+            } else if (arg == "--denoise") {
+                DENOISE = true;
+            } else if (arg == "--perf") {
+                perf_path = value();
+            } else if (arg == "--trace") {
+                trace_path = value();
+            } else if (arg == "--serve") {
+                serve_path = value();
+            } else if (arg.starts_with("-")) {
+                throw std::invalid_argument("unknown option " + arg);
+            } else {
+                scene_name = arg;
+                scene_given = true;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            usage();
+            return 1;
+        }
+    }
 
-    cam.defocus_angle = 0;
-}
+    // render_views() renders every view to its sample count from the one copy of the scene
+    if (!views_path.empty() && (PROGRESSIVE || NUMA == NumaPolicy::replicate)) {
+        std::cerr << "--views cannot be combined with --time-budget or --numa replicate\n";
+        return 1;
+    }
+    // a server takes the scene and how to render it from each job
+    auto render_options = scene_given || !export_path.empty() || width > 0 || spp > 0 ||
+                          depth > 0 || PROGRESSIVE || NUMA != NumaPolicy::off ||
+                          IRRADIANCE_ERROR > 0 || CAUSTIC_PHOTONS > 0 ||
+                          !environment_path.empty() || !views_path.empty() || DENOISE;
+    if (!serve_path.empty() && render_options) {
+        std::cerr << "--serve takes the scene and render settings from its jobs; only --sampler, "
+                     "--perf and --trace apply to it\n";
+        return 1;
+    }
+    if (!preview_path.empty() && !PROGRESSIVE) {
+        std::cerr << "--preview needs --time-budget\n";
+        return 1;
+    }
 
-void cornell_box(HittableList& world, Camera& cam) {
-    auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
-
-    world.add(
-        make_shared<Quad>(Point3d(555, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555), green));
-    world.add(make_shared<Quad>(Point3d(0, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555), red));
-    world.add(make_shared<Quad>(Point3d(343, 554, 332), Vector3d(-130, 0, 0), Vector3d(0, 0, -105),
-                                light));
-    world.add(make_shared<Quad>(Point3d(0, 0, 0), Vector3d(555, 0, 0), Vector3d(0, 0, 555), white));
-    world.add(make_shared<Quad>(Point3d(555, 555, 555), Vector3d(-555, 0, 0), Vector3d(0, 0, -555),
-                                white));
-    world.add(
-        make_shared<Quad>(Point3d(0, 0, 555), Vector3d(555, 0, 0), Vector3d(0, 555, 0), white));
-
-    shared_ptr<Hittable> box1 = box(Point3d(0, 0, 0), Point3d(165, 330, 165), white);
-    box1 = make_shared<RotateY>(box1, 15);
-    box1 = make_shared<Translate>(box1, Vector3d(265, 0, 295));
-    world.add(box1);
-
-    shared_ptr<Hittable> box2 = box(Point3d(0, 0, 0), Point3d(165, 165, 165), white);
-    box2 = make_shared<RotateY>(box2, -18);
-    box2 = make_shared<Translate>(box2, Vector3d(130, 0, 65));
-    world.add(box2);
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = Color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.look_from = Point3d(278, 278, -800);
-    cam.look_at = Point3d(278, 278, 0);
-    cam.v_up = Vector3d(0, 1, 0);
-
-    cam.defocus_angle = 0;
-}
+    if (!perf_path.empty()) {
+        PerfCounters::instance().enable();
+    }
+    if (!trace_path.empty()) {
+        Tracer::instance().enable();
+        Tracer::name_thread("main");
+    }
 
-void cornell_smoke(HittableList& world, Camera& cam) {
-    auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-
-    world.add(
-        make_shared<Quad>(Point3d(555, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555), green));
-    world.add(make_shared<Quad>(Point3d(0, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555), red));
-    world.add(
-        make_shared<Quad>(Point3d(113, 554, 127), Vector3d(330, 0, 0), Vector3d(0, 0, 305), light));
-    world.add(make_shared<Quad>(Point3d(0, 0, 0), Vector3d(555, 0, 0), Vector3d(0, 0, 555), white));
-    world.add(make_shared<Quad>(Point3d(555, 555, 555), Vector3d(-555, 0, 0), Vector3d(0, 0, -555),
-                                white));
-    world.add(
-        make_shared<Quad>(Point3d(0, 0, 555), Vector3d(555, 0, 0), Vector3d(0, 555, 0), white));
-
-    shared_ptr<Hittable> box1 = box(Point3d(0, 0, 0), Point3d(165, 330, 165), white);
-    box1 = make_shared<RotateY>(box1, 15);
-    box1 = make_shared<Translate>(box1, Vector3d(265, 0, 295));
-
-    shared_ptr<Hittable> box2 = box(Point3d(0, 0, 0), Point3d(165, 165, 165), white);
-    box2 = make_shared<RotateY>(box2, -18);
-    box2 = make_shared<Translate>(box2, Vector3d(130, 0, 65));
-
-    world.add(make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
-    world.add(make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = Color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.look_from = Point3d(278, 278, -800);
-    cam.look_at = Point3d(278, 278, 0);
-    cam.v_up = Vector3d(0, 1, 0);
-
-    cam.defocus_angle = 0;
-}
+    int NUM_THREADS = 4;
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth, HittableList& world,
-                 Camera& cam) {
-    HittableList boxes1;
-    auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
-
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i * w;
-            auto z0 = -1000.0 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1, 101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(Point3d(x0, y0, z0), Point3d(x1, y1, z1), ground));
+    if (!serve_path.empty()) {
+        try {
+            RenderSession session(NUM_THREADS, SAMPLER);
+            RenderServer server(session, serve_path);
+            std::clog << "Serving on " << serve_path << '\n';
+            server.run();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return 1;
         }
+        write_reports(perf_path, trace_path);
+        return 0;
     }
 
-    world.add(make_shared<BvhNode>(boxes1));
-
-    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-    world.add(
-        make_shared<Quad>(Point3d(123, 554, 147), Vector3d(300, 0, 0), Vector3d(0, 0, 265), light));
-
-    auto center1 = Point3d(400, 400, 200);
-    auto center2 = center1 + Vector3d(30, 0, 0);
-    auto sphere_material = make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-    world.add(make_shared<Sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<Sphere>(Point3d(260, 150, 45), 50, make_shared<Dielectric>(1.5)));
-    world.add(make_shared<Sphere>(Point3d(0, 150, 145), 50,
-                                  make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
-
-    auto boundary = make_shared<Sphere>(Point3d(360, 150, 145), 70, make_shared<Dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-    boundary = make_shared<Sphere>(Point3d(0, 0, 0), 5000, make_shared<Dielectric>(1.5));
-    world.add(make_shared<ConstantMedium>(boundary, 0.0001, Color(1, 1, 1)));
-
-    auto emat = make_shared<Lambertian>(make_shared<ImageTexture>("earthmap.jpg"));
-    world.add(make_shared<Sphere>(Point3d(400, 200, 400), 100, emat));
-    auto pertext = make_shared<NoiseTexture>(0.1);
-    world.add(make_shared<Sphere>(Point3d(220, 280, 300), 80, make_shared<Lambertian>(pertext)));
-
-    HittableList boxes2;
-    auto white = make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<Sphere>(Point3d::random(0, 165), 10, white));
+    // the scene is built, and so first touched, on the node of the first worker; the main thread
+    // gets its mask back afterwards so the threads it starts later are not stuck on that CPU
+    const auto& topology = NumaTopology::instance();
+    const auto MAIN_AFFINITY = current_affinity();
+    if (NUMA != NumaPolicy::off) {
+        pin_current_thread(topology.worker_cpu(0));
     }
 
-    world.add(make_shared<Translate>(make_shared<RotateY>(make_shared<BvhNode>(boxes2), 15),
-                                     Vector3d(-100, 270, 395)));
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth = max_depth;
-    cam.background = Color(0, 0, 0);
+    HittableList world;
+    HittableList lights;
+    LightBvh light_tree;  // what the camera samples 'lights' through
+    Camera cam;
 
-    cam.vfov = 40;
-    cam.look_from = Point3d(478, 278, -600);
-    cam.look_at = Point3d(278, 278, 0);
-    cam.v_up = Vector3d(0, 1, 0);
+    // a binary scene is used in place from the mapping; the other kinds are built in memory
+    SceneDescription description;
+    std::unique_ptr<MappedScene> mapped;
+    SceneView scene;
+
+    // under NumaPolicy::replicate, node n > 0 renders from scene copy n
+    std::vector<HittableList> node_world(topology.node_count());
+    std::vector<HittableList> node_lights(topology.node_count());
+    std::vector<LightBvh> node_light_tree(topology.node_count());
+
+    try {
+        PhaseScope scene_build(Phase::scene_build);
+        TraceScope trace("scene build");
+
+        if (builtin_scene(scene_name, description)) {
+            scene = description.view();
+        } else if (MappedScene::is_binary(scene_name)) {
+            mapped = std::make_unique<MappedScene>(scene_name);
+            scene = mapped->view();
+        } else {
+            std::ifstream file(scene_name);
+            if (!file) {
+                std::cerr << "no built-in scene or scene file named '" << scene_name << "'\n";
+                usage();
+                return 1;
+            }
+            description = read_scene_text(file);
+            scene = description.view();
+        }
 
-    cam.defocus_angle = 0;
-}
+        if (!export_path.empty()) {
+            if (export_path.ends_with(".rtws")) {
+                write_scene_binary(scene, export_path);
+            } else {
+                std::ofstream out(export_path);
+                write_scene_text(scene, out);
+            }
+            std::clog << "Wrote " << scene.objects.size() << " objects to " << export_path << '\n';
+            return 0;
+        }
 
-int main(int, char**) {
-    HittableList world;
-    Camera cam;
-    int SCENE = 10;
-
-    switch (SCENE) {
-        case 1:
-            random_spheres(world, cam);
-            break;
-        case 2:
-            two_spheres(world, cam);
-            break;
-        case 3:
-            earth(world, cam);
-            break;
-        case 4:
-            two_perlin_spheres(world, cam);
-            break;
-        case 5:
-            quads(world, cam);
-            break;
-        case 6:
-            simple_light(world, cam);
-            break;
-        case 7:
-            cornell_box(world, cam);
-            break;
-        case 8:
-            cornell_smoke(world, cam);
-            break;
-        case 9:
-            final_scene(800, 10000, 40, world, cam);
-            break;
-        default:
-            final_scene(400, 250, 4, world, cam);
+        // build_scene() draws from the global random stream (BVH split axes, noise tables), so
+        // replicated builds each restart it to come out identical
+        if (NUMA == NumaPolicy::replicate) {
+            srand(1);
+        }
+        build_scene(scene, world, lights, cam);
+        light_tree = LightBvh(lights);
+
+        // each copy is built by a thread on its node so that its pages are allocated there
+        for (int node = 1; NUMA == NumaPolicy::replicate && node < topology.node_count(); ++node) {
+            std::async(std::launch::async, [&, node]() {
+                pin_current_thread(topology.cpus(node)[0]);
+                TraceScope replica("scene replica", node);
+                Camera unused;
+                srand(1);
+                build_scene(scene, node_world[node], node_lights[node], unused);
+                node_light_tree[node] = LightBvh(node_lights[node]);
+            }).get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (NUMA != NumaPolicy::off) {
+        restore_affinity(MAIN_AFFINITY);
     }
 
-    int NUM_THREADS = 4;
-    int SAMPLES_PER_PIXEL = cam.samples_per_pixel / NUM_THREADS;
-    cam.samples_per_pixel = SAMPLES_PER_PIXEL;
-    std::vector<std::future<std::vector<std::vector<Color>>>> futures(NUM_THREADS);
-
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        futures[i] = std::async(std::launch::async, render, world, cam);
+    if (width > 0) cam.image_width = width;
+    if (spp > 0) cam.samples_per_pixel = spp;
+    if (depth > 0) cam.max_depth = depth;
+    cam.sampler_type = SAMPLER;
+    if (IRRADIANCE_ERROR > 0) {
+        cam.irradiance_cache = std::make_shared<IrradianceCache>(IRRADIANCE_ERROR);
+    }
+    if (!environment_path.empty()) {
+        try {
+            cam.environment = std::make_shared<const EnvironmentMap>(environment_path);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+        std::clog << "Loaded " << cam.environment->image_width() << 'x'
+                  << cam.environment->image_height() << " environment map\n";
+    }
+    if (CAUSTIC_PHOTONS > 0) {
+        TraceScope trace("photon tracing");
+        auto photons = std::make_shared<const PhotonMap>(world, lights, CAUSTIC_PHOTONS,
+                                                         cam.max_depth, NUM_THREADS);
+        std::clog << "Stored " << photons->size() << " caustic photons, lookup radius "
+                  << photons->lookup_radius() << '\n';
+        cam.caustics = photons;
     }
 
-    std::vector<std::vector<std::vector<Color>>> results(NUM_THREADS);
+    if (!views_path.empty()) {
+        std::vector<Camera> views;
+        std::vector<std::string> images;
+        try {
+            std::ifstream file(views_path);
+            if (!file) {
+                throw std::runtime_error("could not read views from " + views_path);
+            }
+            read_views(file, cam, views, images);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+
+        auto rendered = render_views(world, light_tree, views, NUM_THREADS,
+                                     NUMA != NumaPolicy::off);
+        auto failed = false;
+        for (size_t v = 0; v < rendered.size(); ++v) {
+            try {
+                std::ofstream out(images[v]);
+                if (!out) {
+                    throw std::runtime_error("could not open " + images[v]);
+                }
+                write_image(out, rendered[v], DENOISE, NUM_THREADS);
+                out.close();
+                if (!out) {
+                    throw std::runtime_error("could not write " + images[v]);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << '\n';
+                failed = true;
+            }
+        }
+        if (failed) {
+            return 1;
+        }
+        std::clog << "Wrote " << rendered.size() << " views\n";
 
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        results[i] = futures[i].get();
+        write_reports(perf_path, trace_path);
+        return 0;
     }
 
-    auto image_width = results[0][0].size();
-    auto image_height = results[0].size();
+    FrameBuffer result;
+    auto preview_failed = false;
+
+    if (PROGRESSIVE) {
+        ProgressiveSettings settings;
+        settings.time_budget = TIME_BUDGET;
+        settings.threads = NUM_THREADS;
+        settings.pin_threads = NUMA != NumaPolicy::off;
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        // previews are written to a temporary file and renamed so viewers never see a partial
+        // one; after a failure the render goes on without them
+        auto publish = [&](const FrameBuffer& fb) {
+            if (preview_path.empty() || preview_failed) {
+                return;
+            }
+            auto temporary = preview_path + ".tmp";
+            std::ofstream preview(temporary);
+            if (preview) {
+                write_ppm(preview, fb.color, fb.samples);
+                preview.close();
+            }
+            if (!preview || std::rename(temporary.c_str(), preview_path.c_str()) != 0) {
+                std::cerr << "could not write preview " << preview_path << '\n';
+                std::remove(temporary.c_str());
+                preview_failed = true;
+            }
+        };
+        result = cam.render_progressive(world, light_tree, settings, publish);
+    } else {
+        // every sample is rendered: the first total % workers workers take one extra, and each
+        // worker's sample indices follow on from the previous worker's
+        int TOTAL_SAMPLES = cam.samples_per_pixel;
+        int WORKERS = std::max(1, std::min(NUM_THREADS, TOTAL_SAMPLES));
+        cam.sample_count = TOTAL_SAMPLES;
+        std::vector<std::future<FrameBuffer>> futures(WORKERS);
+
+        for (int i = 0, offset = 0; i < WORKERS; ++i) {
+            cam.samples_per_pixel = TOTAL_SAMPLES / WORKERS + (i < TOTAL_SAMPLES % WORKERS ? 1 : 0);
+            cam.sample_offset = offset;
+            offset += cam.samples_per_pixel;
+            futures[i] = std::async(std::launch::async, [&, i, cam]() {
+                // the worker's FrameBuffer is allocated inside render(), on the worker's node
+                auto node = topology.worker_node(i);
+                if (NUMA != NumaPolicy::off) {
+                    pin_current_thread(topology.worker_cpu(i));
+                }
+                if (NUMA == NumaPolicy::replicate && node > 0) {
+                    return render(node_world[node], node_light_tree[node], cam);
+                }
+                return render(world, light_tree, cam);
+            });
+        }
 
-    for (int i = 0; i < image_height; ++i) {
-        for (int j = 0; j < image_width; ++j) {
-            Color pixel_color(0, 0, 0);
-            for (int k = 0; k < NUM_THREADS; ++k) {
-                pixel_color += results[k][i][j];
+        std::vector<FrameBuffer> partials;
+        {
+            TraceScope trace("wait for workers");
+            for (auto& f : futures) {
+                partials.push_back(f.get());
             }
-            write_color(std::cout, pixel_color, NUM_THREADS * SAMPLES_PER_PIXEL);
         }
+
+        TraceScope trace("reduce");
+        result = std::move(partials[0]);
+        for (int i = 1; i < WORKERS; ++i) {
+            result += partials[i];
+        }
+    }
+
+    try {
+        write_image(std::cout, result, DENOISE, NUM_THREADS);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
     }
+    write_reports(perf_path, trace_path);
+    return preview_failed ? 1 : 0;
 }
@@ -3,19 +3,60 @@
 
 #include "color.hpp"
 #include "hittable_list.hpp"
+#include "onb.hpp"
 #include "rtweekend.hpp"
+#include "sampler.hpp"
 #include "texture.hpp"
 
 class HitRecord;
 
+class ScatterRecord {
+public:
+    Ray scattered;
+    Color weight;  // eval() / pdf for sampled lobes, the attenuation for specular ones
+    double pdf;
+    bool is_specular;
+};
+
 class Material {
 public:
     virtual ~Material() = default;
 
+    // Scattering with values from the global random stream. Materials that only implement this
+    // are treated as specular by the default sample().
     virtual bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation,
-                         Ray& scattered) const = 0;
+                         Ray& scattered) const {
+        return false;
+    }
 
     virtual Color emitted(double u, double v, const Point3d& p) const { return Color(0, 0, 0); }
+
+    // Draws a scattered direction with values from 'sampler'. Non-specular lobes also report its
+    // pdf so the integrator can weight it against light sampling.
+    virtual bool sample(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec,
+                        Sampler& sampler) const {
+        srec.pdf = 0;
+        srec.is_specular = true;
+        return scatter(r_in, rec, srec.weight, srec.scattered);
+    }
+
+    // The BSDF (or phase function) times the cosine term for light arriving along 'direction'.
+    virtual Color eval(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const {
+        return Color(0, 0, 0);
+    }
+
+    // The solid-angle density with which sample() picks 'direction'.
+    virtual double pdf(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const {
+        return 0;
+    }
+
+    // Surface color written to the albedo AOV, used by the denoiser to separate texture from
+    // lighting.
+    virtual Color base_color(const HitRecord& rec) const { return Color(1, 1, 1); }
+
+    // True if eval() is base_color() * cosine / pi, so that the light the surface reflects follows
+    // from the irradiance arriving at it alone.
+    virtual bool is_diffuse() const { return false; }
 };
 
 class Lambertian : public Material {
@@ -24,19 +65,40 @@ public:
 
     Lambertian(shared_ptr<Texture> a) : albedo(a) {}
 
-    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation,
-                 Ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
+    bool sample(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec,
+                Sampler& sampler) const override {
+        Onb uvw;
+        uvw.build_from_w(rec.normal);
+        auto [u1, u2] = sampler.get_2d();
+        auto scatter_direction = uvw.local(sample_cosine_direction(u1, u2));
+
+        // cosine-weighted sampling cancels the cosine and 1/pi of the BRDF
+        srec.scattered = Ray(rec.p, scatter_direction, r_in.time());
+        srec.weight = albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
+        srec.pdf = pdf(r_in, rec, scatter_direction);
+        srec.is_specular = false;
+        return srec.pdf > 0;
+    }
 
-        // catch degenerate scatter direction
-        if (scatter_direction.near_zero()) {
-            scatter_direction = rec.normal;
+    Color eval(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const override {
+        auto cosine = dot(rec.normal, unit_vector(direction));
+        if (cosine <= 0) {
+            return Color(0, 0, 0);
         }
-        scattered = Ray(rec.p, scatter_direction, r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
-        return true;
+        return albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint) * (cosine / pi);
     }
 
+    Color base_color(const HitRecord& rec) const override {
+        return albedo->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
+    double pdf(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const override {
+        auto cosine = dot(rec.normal, unit_vector(direction));
+        return cosine <= 0 ? 0 : cosine / pi;
+    }
+
+    bool is_diffuse() const override { return true; }
+
 private:
     shared_ptr<Texture> albedo;
 };
@@ -47,15 +109,30 @@ public:
 
     bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation,
                  Ray& scattered) const override {
-        Vector3d reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = Ray(rec.p, reflected + fuzz * random_unit_vector(), r_in.time());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
+        return reflect_fuzzed(r_in, rec, random_unit_vector(), attenuation, scattered);
     }
 
+    bool sample(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec,
+                Sampler& sampler) const override {
+        auto [u1, u2] = sampler.get_2d();
+        srec.pdf = 0;
+        srec.is_specular = true;
+        return reflect_fuzzed(r_in, rec, sample_unit_vector(u1, u2), srec.weight, srec.scattered);
+    }
+
+    Color base_color(const HitRecord& rec) const override { return albedo; }
+
 private:
     Color albedo;
     double fuzz;
+
+    bool reflect_fuzzed(const Ray& r_in, const HitRecord& rec, const Vector3d& offset,
+                        Color& attenuation, Ray& scattered) const {
+        Vector3d reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        scattered = Ray(rec.p, reflected + fuzz * offset, r_in.time());
+        attenuation = albedo;
+        return (dot(scattered.direction(), rec.normal) > 0);
+    }
 };
 
 class Dielectric : public Material {
@@ -64,6 +141,22 @@ public:
 
     bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation,
                  Ray& scattered) const override {
+        return reflect_or_refract(r_in, rec, random_double(), attenuation, scattered);
+    }
+
+    bool sample(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec,
+                Sampler& sampler) const override {
+        srec.pdf = 0;
+        srec.is_specular = true;
+        return reflect_or_refract(r_in, rec, sampler.get_1d(), srec.weight, srec.scattered);
+    }
+
+private:
+    double ir;
+
+    // 'u' in [0, 1) chooses between reflection and refraction in proportion to the reflectance.
+    bool reflect_or_refract(const Ray& r_in, const HitRecord& rec, double u, Color& attenuation,
+                            Ray& scattered) const {
         attenuation = Color(1.0, 1.0, 1.0);
         double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
@@ -74,7 +167,7 @@ public:
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         Vector3d direction;
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()) {
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > u) {
             direction = reflect(unit_direction, rec.normal);
         } else {
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -84,9 +177,6 @@ public:
         return true;
     }
 
-private:
-    double ir;
-
     static double reflectance(double cosine, double ref_idx) {
         // use Schlick's approximation for reflectance
         auto r0 = (1 - ref_idx) / (1 + ref_idx);
@@ -120,13 +210,28 @@ public:
 
     Isotropic(shared_ptr<Texture> a) : albedo(a) {}
 
-    bool scatter(const Ray& r_in, const HitRecord& rec, Color& attenuation,
-                 Ray& scattered) const override {
-        scattered = Ray(rec.p, random_unit_vector(), r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+    bool sample(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec,
+                Sampler& sampler) const override {
+        auto [u1, u2] = sampler.get_2d();
+        srec.scattered = Ray(rec.p, sample_unit_vector(u1, u2), r_in.time());
+        srec.weight = albedo->value(rec.u, rec.v, rec.p);
+        srec.pdf = 1 / (4 * pi);
+        srec.is_specular = false;
         return true;
     }
 
+    Color eval(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const override {
+        return albedo->value(rec.u, rec.v, rec.p) / (4 * pi);
+    }
+
+    double pdf(const Ray& r_in, const HitRecord& rec, const Vector3d& direction) const override {
+        return 1 / (4 * pi);
+    }
+
+    Color base_color(const HitRecord& rec) const override {
+        return albedo->value(rec.u, rec.v, rec.p);
+    }
+
 private:
     shared_ptr<Texture> albedo;
 };
@@ -0,0 +1,111 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "hittable.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "sampler.hpp"
+#include "trace.hpp"
+
+// Renders several views of one scene, such as stereo pairs, turntable angles or thumbnails, from a
+// single build of it. The views are cut into tiles and all tiles go through one pool of 'threads'
+// threads, which take the next tile whatever view it belongs to. The BVH, the texture cache and
+// any irradiance cache or photon map the cameras share are all warmed once, and no thread idles
+// while another finishes a view. With 'pin_threads' the workers are pinned to CPUs spread over
+// the NUMA nodes. Returns one image per view, in order.
+inline std::vector<FrameBuffer> render_views(const Hittable& world, const Hittable& lights,
+                                             std::vector<Camera> views, int threads = 4,
+                                             bool pin_threads = false, int tile_size = 32) {
+    struct Tile {
+        size_t view;
+        PixelRegion pixels;
+    };
+
+    std::vector<FrameBuffer> images;
+    std::vector<Tile> tiles;
+    for (size_t v = 0; v < views.size(); ++v) {
+        images.push_back(views[v].prepare(lights));
+        for (int y = 0; y < images[v].height; y += tile_size) {
+            for (int x = 0; x < images[v].width; x += tile_size) {
+                tiles.push_back({v, {x, y, x + tile_size, y + tile_size}});
+            }
+        }
+    }
+
+    std::atomic<size_t> next_tile = 0;
+    std::vector<std::future<void>> workers;
+    for (int t = 0; t < std::max(1, threads); ++t) {
+        workers.push_back(std::async(std::launch::async, [&, t]() {
+            if (pin_threads) {
+                pin_current_thread(NumaTopology::instance().worker_cpu(t));
+            }
+            PhaseScope tracing(Phase::tracing);
+            Tracer::name_thread("view worker");
+            std::vector<std::unique_ptr<Sampler>> samplers(views.size());
+            for (auto i = next_tile++; i < tiles.size(); i = next_tile++) {
+                const auto& tile = tiles[i];
+                const auto& view = views[tile.view];
+                TraceScope trace("tile", static_cast<int>(tile.view));
+                auto& sampler = samplers[tile.view];
+                if (!sampler) {
+                    sampler = make_sampler(view.sampler_type, view.total_samples());
+                }
+                view.render_tile(world, lights, tile.pixels, *sampler, images[tile.view]);
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.get();
+    }
+
+    return images;
+}
+
+// Reads views for render_views(), one per line as
+//
+//   <image file> <look_from xyz> <look_at xyz> [vfov]
+//
+// each a copy of 'base' with those settings; '#' starts a comment. Throws std::runtime_error on a
+// malformed line.
+inline void read_views(std::istream& in, const Camera& base, std::vector<Camera>& views,
+                       std::vector<std::string>& images) {
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string image;
+        if (!(fields >> image)) {
+            continue;
+        }
+
+        auto view = base;
+        double x, y, z, tx, ty, tz;
+        if (!(fields >> x >> y >> z >> tx >> ty >> tz)) {
+            throw std::runtime_error("view line " + std::to_string(number) +
+                                     ": expected <image> <look_from xyz> <look_at xyz> [vfov]");
+        }
+        view.look_from = Point3d(x, y, z);
+        view.look_at = Point3d(tx, ty, tz);
+        double vfov;
+        if (fields >> vfov) {
+            view.vfov = vfov;
+        }
+
+        views.push_back(view);
+        images.push_back(image);
+    }
+}
+
+#endif  // MULTI_VIEW_H
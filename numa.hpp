@@ -0,0 +1,139 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Linux-only placement of render threads on multi-socket machines. The topology is read from
+// /sys/devices/system/node, restricted to the CPUs this process may run on; where that is missing
+// (no NUMA support, unusual containers) every allowed CPU is treated as one node. Workers are
+// spread round-robin over the nodes so each node's memory bandwidth is used, and pinned so the
+// scheduler cannot migrate them away from the memory they first touched.
+
+enum class NumaPolicy {
+    off,        // threads float wherever the scheduler puts them
+    pin,        // workers are pinned; the scene lives where the main thread built it
+    replicate,  // workers are pinned and every node renders from its own copy of the scene
+};
+
+inline bool parse_numa_policy(const std::string& name, NumaPolicy& policy) {
+    if (name == "off") {
+        policy = NumaPolicy::off;
+    } else if (name == "pin") {
+        policy = NumaPolicy::pin;
+    } else if (name == "replicate") {
+        policy = NumaPolicy::replicate;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses the kernel's CPU list format, e.g. "0-7,16-23".
+inline std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream ranges(text);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        auto dash = range.find('-');
+        auto first = std::stoi(range.substr(0, dash));
+        auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Restricts the calling thread to 'cpu'. Returns false if the kernel refused.
+inline bool pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// The CPUs the calling thread may run on, to hand back to restore_affinity() after pinning it.
+inline cpu_set_t current_affinity() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    return set;
+}
+
+inline bool restore_affinity(const cpu_set_t& set) {
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+class NumaTopology {
+public:
+    static const NumaTopology& instance() {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    int node_count() const { return static_cast<int>(nodes.size()); }
+
+    const std::vector<int>& cpus(int node) const { return nodes[node]; }
+
+    // Worker 'worker' goes to node worker % node_count(), taking that node's CPUs in turn.
+    int worker_node(int worker) const { return worker % node_count(); }
+
+    int worker_cpu(int worker) const {
+        const auto& node = nodes[worker_node(worker)];
+        return node[(worker / node_count()) % node.size()];
+    }
+
+private:
+    std::vector<std::vector<int>> nodes;  // allowed CPUs of each node that has any
+
+    NumaTopology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            CPU_ZERO(&allowed);
+            CPU_SET(0, &allowed);
+        }
+
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string text;
+        if (online && std::getline(online, text)) {
+            for (auto node : parse_cpu_list(text)) {
+                std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) +
+                                   "/cpulist");
+                std::string cpulist;
+                if (!list || !std::getline(list, cpulist)) {
+                    continue;
+                }
+                std::vector<int> usable;
+                for (auto cpu : parse_cpu_list(cpulist)) {
+                    if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                        usable.push_back(cpu);
+                    }
+                }
+                if (!usable.empty()) {
+                    nodes.push_back(usable);
+                }
+            }
+        }
+
+        if (nodes.empty()) {
+            std::vector<int> all;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    all.push_back(cpu);
+                }
+            }
+            nodes.push_back(all);
+        }
+    }
+};
+
+#endif  // NUMA_H
@@ -0,0 +1,36 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "rtweekend.hpp"
+
+// Orthonormal basis built around a given w axis.
+class Onb {
+public:
+    Onb() {}
+
+    Vector3d operator[](int i) const { return axis[i]; }
+    Vector3d& operator[](int i) { return axis[i]; }
+
+    Vector3d u() const { return axis[0]; }
+    Vector3d v() const { return axis[1]; }
+    Vector3d w() const { return axis[2]; }
+
+    Vector3d local(double a, double b, double c) const { return a * u() + b * v() + c * w(); }
+
+    Vector3d local(const Vector3d& a) const { return a.x() * u() + a.y() * v() + a.z() * w(); }
+
+    void build_from_w(const Vector3d& w) {
+        Vector3d unit_w = unit_vector(w);
+        Vector3d a = (fabs(unit_w.x()) > 0.9) ? Vector3d(0, 1, 0) : Vector3d(1, 0, 0);
+        Vector3d v = unit_vector(cross(unit_w, a));
+        Vector3d u = cross(unit_w, v);
+        axis[0] = u;
+        axis[1] = v;
+        axis[2] = unit_w;
+    }
+
+private:
+    Vector3d axis[3];
+};
+
+#endif  // ONB_H
@@ -0,0 +1,362 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Optional instrumentation that charges hardware counters and wall time to render phases. Each
+// thread opens its own perf_event_open counter group on first use and reads it whenever it
+// switches phase, so a phase's totals are the sum of the deltas over every thread that ran it.
+// Phases switch at every bounce and shadow ray, so the counters are read with rdpmc through the
+// events' mmap pages, without entering the kernel; where the kernel does not allow that, reads
+// fall back to read(2) and the report says the per-bounce phases include its cost. If the
+// counters cannot be opened (no PMU, perf_event_paranoid, containers) only the timers are kept.
+// Until enable() is called, PhaseScope costs a single predictable branch.
+
+enum class Phase : int { idle, scene_build, bvh_build, tracing, shading, output };
+
+inline constexpr int phase_count = 6;
+
+inline const char* phase_name(Phase phase) {
+    static const char* names[phase_count] = {"idle",    "scene_build", "bvh_build",
+                                             "tracing", "shading",     "output"};
+    return names[static_cast<int>(phase)];
+}
+
+class PerfCounters {
+public:
+    static constexpr int counter_count = 5;
+
+    static constexpr std::array<const char*, counter_count> counter_names = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+    static PerfCounters& instance() {
+        static PerfCounters counters;
+        return counters;
+    }
+
+    // Must be called before the threads to be measured start.
+    void enable() { active = true; }
+
+    bool enabled() const { return active; }
+
+    // Charges everything since the calling thread's last switch to its current phase and makes
+    // 'phase' current. Returns the phase that was current.
+    static Phase switch_phase(Phase phase) {
+        if (!active) {
+            return phase;
+        }
+        return local().switch_to(phase);
+    }
+
+    // Prints a per-phase table and writes the same totals as JSON. Times are summed over threads.
+    // Counters of threads that are still running are not included.
+    void report(std::ostream& table, std::ostream& json) {
+        local().flush();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto flags = table.flags();
+        auto precision = table.precision();
+
+        table << "\nPhase         thread-s";
+        for (auto name : counter_names) {
+            table << std::setw(15) << name;
+        }
+        table << "\n";
+
+        for (int p = 1; p < phase_count; ++p) {
+            const auto& t = totals[p];
+            table << std::left << std::setw(13) << phase_name(static_cast<Phase>(p)) << std::right
+                  << std::setw(9) << std::fixed << std::setprecision(3) << t.seconds;
+            for (int c = 0; c < counter_count; ++c) {
+                if (available[c]) {
+                    table << std::setw(15) << t.counts[c];
+                } else {
+                    table << std::setw(15) << "-";
+                }
+            }
+            table << "\n";
+        }
+        if (!counters_opened) {
+            table << "hardware counters unavailable (" << failure << "), timers only\n";
+        } else if (!user_space_reads) {
+            table << "rdpmc unavailable: counters were read with read(2), whose cost the tracing "
+                     "and shading phases include\n";
+        }
+        table.flags(flags);
+        table.precision(precision);
+
+        json << "{\n  \"hardware_counters\": " << (counters_opened ? "true" : "false") << ",\n"
+             << "  \"user_space_reads\": "
+             << (counters_opened && user_space_reads ? "true" : "false") << ",\n  \"phases\": {";
+        for (int p = 1; p < phase_count; ++p) {
+            const auto& t = totals[p];
+            json << (p > 1 ? ",\n" : "\n") << "    \"" << phase_name(static_cast<Phase>(p))
+                 << "\": {\"seconds\": " << t.seconds;
+            for (int c = 0; c < counter_count; ++c) {
+                if (available[c]) {
+                    json << ", \"" << counter_names[c] << "\": " << t.counts[c];
+                }
+            }
+            json << "}";
+        }
+        json << "\n  }\n}\n";
+    }
+
+private:
+    struct Totals {
+        double seconds = 0;
+        std::array<uint64_t, counter_count> counts{};
+    };
+
+    // Counter group and per-phase accumulators of one thread, merged into the global totals when
+    // the thread exits.
+    class ThreadState {
+    public:
+        ThreadState() { open(); }
+
+        ~ThreadState() {
+            flush();
+            for (int c = 0; c < counter_count; ++c) {
+                if (pages[c] != nullptr) {
+                    munmap(pages[c], page_size());
+                }
+                if (fds[c] >= 0) {
+                    close(fds[c]);
+                }
+            }
+        }
+
+        Phase switch_to(Phase phase) {
+            auto now = std::chrono::steady_clock::now();
+            auto values = last_values;
+            read_counters(values);
+
+            auto& t = phases[static_cast<int>(current)];
+            t.seconds += std::chrono::duration<double>(now - last_time).count();
+            for (int c = 0; c < counter_count; ++c) {
+                t.counts[c] += values[c] - last_values[c];
+            }
+
+            last_time = now;
+            last_values = values;
+
+            auto previous = current;
+            current = phase;
+            return previous;
+        }
+
+        void flush() {
+            switch_to(current);
+            instance().merge(phases);
+            phases = {};
+        }
+
+    private:
+        std::array<int, counter_count> fds{-1, -1, -1, -1, -1};
+        std::array<int, counter_count> slot{};  // position of each counter in a group read
+        std::array<perf_event_mmap_page*, counter_count> pages{};  // for rdpmc; null if unmapped
+        int opened = 0;
+        bool reported_read_path = false;
+        Phase current = Phase::idle;
+        std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+        std::array<uint64_t, counter_count> last_values{};
+        std::array<Totals, phase_count> phases{};
+
+        void open() {
+            static const std::array<std::pair<uint32_t, uint64_t>, counter_count> events = {{
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+                {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            }};
+
+            std::array<bool, counter_count> ok{};
+            for (int c = 0; c < counter_count; ++c) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = events[c].first;
+                attr.config = events[c].second;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+
+                // the cycle counter leads the group; the others are optional members
+                auto leader = c == 0 ? -1 : fds[0];
+                if (c > 0 && leader < 0) {
+                    break;
+                }
+                fds[c] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                if (fds[c] >= 0) {
+                    slot[c] = opened++;
+                    ok[c] = true;
+                    auto page = mmap(nullptr, page_size(), PROT_READ, MAP_SHARED, fds[c], 0);
+                    if (page != MAP_FAILED) {
+                        pages[c] = static_cast<perf_event_mmap_page*>(page);
+                    }
+                } else if (c == 0) {
+                    instance().record_failure(std::strerror(errno));
+                }
+            }
+
+            instance().record_available(ok);
+            read_counters(last_values);
+        }
+
+        static size_t page_size() { return static_cast<size_t>(sysconf(_SC_PAGESIZE)); }
+
+        void read_counters(std::array<uint64_t, counter_count>& values) {
+            if (opened == 0) {
+                return;
+            }
+
+            auto user_space = read_user_space(values);
+            if (!reported_read_path) {
+                instance().record_user_space_reads(user_space);
+                reported_read_path = true;
+            }
+            if (user_space) {
+                return;
+            }
+
+            uint64_t buffer[1 + counter_count];
+            auto bytes = ::read(fds[0], buffer, sizeof(buffer));
+            if (bytes < static_cast<ssize_t>(sizeof(uint64_t) * (1 + opened))) {
+                return;
+            }
+            for (int c = 0; c < counter_count; ++c) {
+                if (fds[c] >= 0) {
+                    values[c] = buffer[1 + slot[c]];
+                }
+            }
+        }
+
+        // Reads every open counter with rdpmc, following the seqlock protocol documented for
+        // perf_event_mmap_page. Returns false, leaving 'values' alone, if any counter cannot be
+        // read that way.
+        bool read_user_space(std::array<uint64_t, counter_count>& values) const {
+#if defined(__x86_64__) || defined(__i386__)
+            std::array<uint64_t, counter_count> counts{};
+            for (int c = 0; c < counter_count; ++c) {
+                if (fds[c] < 0) {
+                    continue;
+                }
+                const volatile auto* page = pages[c];
+                if (page == nullptr) {
+                    return false;
+                }
+
+                uint32_t sequence;
+                do {
+                    sequence = page->lock;
+                    std::atomic_signal_fence(std::memory_order_seq_cst);
+                    if (!page->cap_user_rdpmc) {
+                        return false;
+                    }
+                    auto index = page->index;
+                    int64_t count = page->offset;
+                    if (index != 0) {
+                        // the hardware counter is pmc_width bits wide; sign-extend it
+                        auto width = page->pmc_width;
+                        auto pmc = static_cast<int64_t>(__rdpmc(static_cast<int>(index - 1)));
+                        count += static_cast<int64_t>(static_cast<uint64_t>(pmc) << (64 - width)) >>
+                                 (64 - width);
+                    }
+                    counts[c] = static_cast<uint64_t>(count);
+                    std::atomic_signal_fence(std::memory_order_seq_cst);
+                } while (page->lock != sequence);
+            }
+            for (int c = 0; c < counter_count; ++c) {
+                if (fds[c] >= 0) {
+                    values[c] = counts[c];
+                }
+            }
+            return true;
+#else
+            (void)values;
+            return false;
+#endif
+        }
+    };
+
+    static inline bool active = false;
+
+    std::mutex mutex;
+    std::array<Totals, phase_count> totals{};
+    std::array<bool, counter_count> available{true, true, true, true, true};
+    bool counters_opened = true;
+    bool user_space_reads = true;
+    std::string failure;
+
+    static ThreadState& local() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    void merge(const std::array<Totals, phase_count>& phases) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int p = 0; p < phase_count; ++p) {
+            totals[p].seconds += phases[p].seconds;
+            for (int c = 0; c < counter_count; ++c) {
+                totals[p].counts[c] += phases[p].counts[c];
+            }
+        }
+    }
+
+    // A counter is reported only if every thread managed to open it.
+    void record_available(const std::array<bool, counter_count>& ok) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int c = 0; c < counter_count; ++c) {
+            available[c] = available[c] && ok[c];
+        }
+        counters_opened = counters_opened && ok[0];
+    }
+
+    void record_user_space_reads(bool ok) {
+        std::lock_guard<std::mutex> lock(mutex);
+        user_space_reads = user_space_reads && ok;
+    }
+
+    void record_failure(const char* reason) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failure.empty()) {
+            failure = reason;
+        }
+    }
+};
+
+// Attributes the enclosing block to a phase, restoring the previous phase on exit.
+class PhaseScope {
+public:
+    explicit PhaseScope(Phase phase) : previous(PerfCounters::switch_phase(phase)) {}
+
+    ~PhaseScope() { PerfCounters::switch_phase(previous); }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+private:
+    Phase previous;
+};
+
+#endif  // PERF_COUNTERS_H
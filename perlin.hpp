@@ -1,48 +1,54 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
 #include "rtweekend.hpp"
 
+// Gradient noise with compact tables: the three permutations are byte arrays and the gradients
+// are stored as separate float x/y/z arrays, so one lattice cell reads eight bytes of permutation
+// data and gathers its eight corner gradients straight into SIMD lanes. With SSE the eight corner
+// contributions and their trilinear weights are evaluated as two 4-wide vectors.
 class Perlin {
 public:
     Perlin() {
-        ranvec = new Vector3d[point_count];
         for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = unit_vector(Vector3d::random(-1, 1));
+            auto g = unit_vector(Vector3d::random(-1, 1));
+            grad_x[i] = static_cast<float>(g.x());
+            grad_y[i] = static_cast<float>(g.y());
+            grad_z[i] = static_cast<float>(g.z());
         }
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
-    }
-
-    ~Perlin() {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+        perlin_generate_perm(perm_x);
+        perlin_generate_perm(perm_y);
+        perlin_generate_perm(perm_z);
     }
 
     double noise(const Point3d& p) const {
-        auto u = p.x() - floor(p.x());
-        auto v = p.y() - floor(p.y());
-        auto w = p.z() - floor(p.z());
-
-        auto i = static_cast<int>(floor(p.x()));
-        auto j = static_cast<int>(floor(p.y()));
-        auto k = static_cast<int>(floor(p.z()));
-        Vector3d c[2][2][2];
-
-        for (int di = 0; di < 2; ++di) {
-            for (int dj = 0; dj < 2; ++dj) {
-                for (int dk = 0; dk < 2; ++dk) {
-                    c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^
-                                           perm_z[(k + dk) & 255]];
-                }
-            }
+        auto i = fast_floor(p.x());
+        auto j = fast_floor(p.y());
+        auto k = fast_floor(p.z());
+
+        auto u = static_cast<float>(p.x() - i);
+        auto v = static_cast<float>(p.y() - j);
+        auto w = static_cast<float>(p.z() - k);
+
+        const int px[2] = {perm_x[i & 255], perm_x[(i + 1) & 255]};
+        const int py[2] = {perm_y[j & 255], perm_y[(j + 1) & 255]};
+        const int pz[2] = {perm_z[k & 255], perm_z[(k + 1) & 255]};
+
+        // corner c is (c >> 2, (c >> 1) & 1, c & 1)
+        alignas(16) float gx[8], gy[8], gz[8];
+        for (int c = 0; c < 8; ++c) {
+            auto index = px[c >> 2] ^ py[(c >> 1) & 1] ^ pz[c & 1];
+            gx[c] = grad_x[index];
+            gy[c] = grad_y[index];
+            gz[c] = grad_z[index];
         }
 
-        return perlin_interp(c, u, v, w);
+        return perlin_interp(gx, gy, gz, u, v, w);
     }
 
     double turb(const Point3d& p, int depth = 7) const {
@@ -61,49 +67,75 @@ public:
 
 private:
     static const int point_count = 256;
-    Vector3d* ranvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
-
-    static int* perlin_generate_perm() {
-        auto p = new int[point_count];
+    alignas(16) float grad_x[point_count];
+    alignas(16) float grad_y[point_count];
+    alignas(16) float grad_z[point_count];
+    unsigned char perm_x[point_count];
+    unsigned char perm_y[point_count];
+    unsigned char perm_z[point_count];
+
+    // floor() is a library call on baseline x86-64; truncation plus a fix-up is not
+    static int fast_floor(double x) {
+        auto i = static_cast<int>(x);
+        return (x < i) ? i - 1 : i;
+    }
 
+    static void perlin_generate_perm(unsigned char* p) {
         for (int i = 0; i < Perlin::point_count; ++i) {
-            p[i] = i;
+            p[i] = static_cast<unsigned char>(i);
         }
 
         permute(p, point_count);
-
-        return p;
     }
 
-    static void permute(int* p, int n) {
+    static void permute(unsigned char* p, int n) {
         for (int i = n - 1; i > 0; --i) {
             int target = random_int(0, i);
-            int tmp = p[i];
+            unsigned char tmp = p[i];
             p[i] = p[target];
             p[target] = tmp;
         }
     }
 
-    static double perlin_interp(Vector3d c[2][2][2], double u, double v, double w) {
+    static double perlin_interp(const float* gx, const float* gy, const float* gz, float u,
+                                float v, float w) {
         auto uu = u * u * (3 - 2 * u);
         auto vv = v * v * (3 - 2 * v);
         auto ww = w * w * (3 - 2 * w);
-        auto accum = 0.0;
 
-        for (int i = 0; i < 2; ++i) {
-            for (int j = 0; j < 2; ++j) {
-                for (int k = 0; k < 2; ++k) {
-                    Vector3d weight_v(u - i, v - j, w - k);
-                    accum += (i * uu + (1 - i) * (1 - uu)) * (j * vv + (1 - j) * (1 - vv)) *
-                             (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
-                }
-            }
+#if defined(__SSE2__) || defined(_M_X64)
+        // lanes 0-3 hold the corners with i = 0, lanes 4-7 those with i = 1; within each half
+        // (j, k) runs over (0,0), (0,1), (1,0), (1,1)
+        auto dy = _mm_sub_ps(_mm_set1_ps(v), _mm_setr_ps(0, 0, 1, 1));
+        auto dz = _mm_sub_ps(_mm_set1_ps(w), _mm_setr_ps(0, 1, 0, 1));
+        auto wy = _mm_setr_ps(1 - vv, 1 - vv, vv, vv);
+        auto wyz = _mm_mul_ps(wy, _mm_setr_ps(1 - ww, ww, 1 - ww, ww));
+
+        auto yz_lo = _mm_add_ps(_mm_mul_ps(_mm_load_ps(gy), dy), _mm_mul_ps(_mm_load_ps(gz), dz));
+        auto yz_hi =
+            _mm_add_ps(_mm_mul_ps(_mm_load_ps(gy + 4), dy), _mm_mul_ps(_mm_load_ps(gz + 4), dz));
+        auto dot_lo = _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx), _mm_set1_ps(u)), yz_lo);
+        auto dot_hi = _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx + 4), _mm_set1_ps(u - 1)), yz_hi);
+
+        auto blended = _mm_add_ps(_mm_mul_ps(dot_lo, _mm_set1_ps(1 - uu)),
+                                  _mm_mul_ps(dot_hi, _mm_set1_ps(uu)));
+        auto sum = _mm_mul_ps(blended, wyz);
+
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+#else
+        auto accum = 0.0f;
+
+        for (int c = 0; c < 8; ++c) {
+            auto i = c >> 2, j = (c >> 1) & 1, k = c & 1;
+            auto dot = gx[c] * (u - i) + gy[c] * (v - j) + gz[c] * (w - k);
+            accum += (i * uu + (1 - i) * (1 - uu)) * (j * vv + (1 - j) * (1 - vv)) *
+                     (k * ww + (1 - k) * (1 - ww)) * dot;
         }
 
         return accum;
+#endif
     }
 };
 
@@ -0,0 +1,255 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "aabb.hpp"
+#include "color.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "onb.hpp"
+#include "rtweekend.hpp"
+#include "sampler.hpp"
+
+// A photon that reached a diffuse surface through one or more specular bounces.
+class Photon {
+public:
+    Point3d p;
+    Vector3d direction;  // of travel, towards the surface
+    Color power;
+};
+
+// Caustic photon map. Photons are emitted from the lights, followed through specular bounces
+// (glass, mirrors) and stored where they first land on a diffuse surface; photons whose first hit
+// is diffuse are dropped, since path tracing with light sampling handles that light well. At
+// render time the reflected caustic radiance at a diffuse point is a density estimate over the
+// photons within 'radius', and the camera stops counting emission it reaches through the same
+// diffuse -> specular -> light chains so no light is counted twice.
+//
+// Photons are kept in a hashed grid of cells twice the radius wide, sorted so each cell's photons
+// are contiguous; an estimate reads at most eight cells.
+class PhotonMap {
+public:
+    // Traces 'count' photons from the emitters in 'lights' through 'world' on 'threads' threads.
+    // The lookup radius is chosen so that a typical estimate where photons landed gathers about
+    // 'photons_per_estimate' of them.
+    PhotonMap(const Hittable& world, const HittableList& lights, int count, int max_depth,
+              int threads = 4, int photons_per_estimate = 32) {
+        std::vector<double> cdf;
+        double total_area = 0;
+        for (const auto& light : lights.objects) {
+            total_area += light->surface_area();
+            cdf.push_back(total_area);
+        }
+        if (total_area <= 0 || count <= 0) {
+            return;
+        }
+
+        std::vector<std::future<std::vector<Photon>>> parts;
+        for (int t = 0; t < threads; ++t) {
+            auto first = static_cast<int>(static_cast<int64_t>(count) * t / threads);
+            auto last = static_cast<int>(static_cast<int64_t>(count) * (t + 1) / threads);
+            parts.push_back(std::async(std::launch::async, [&, first, last]() {
+                std::vector<Photon> found;
+                for (int i = first; i < last; ++i) {
+                    trace(i, count, world, lights, cdf, total_area, max_depth, found);
+                }
+                return found;
+            }));
+        }
+        for (auto& part : parts) {
+            auto found = part.get();
+            photons.insert(photons.end(), found.begin(), found.end());
+        }
+        if (photons.empty()) {
+            return;
+        }
+
+        for (const auto& photon : photons) {
+            bounds = Aabb(bounds, Aabb(photon.p, photon.p));
+        }
+        radius = typical_radius(photons_per_estimate);
+        bounds = Aabb(bounds.x.expand(2 * radius), bounds.y.expand(2 * radius),
+                      bounds.z.expand(2 * radius));
+
+        build_grid();
+    }
+
+    size_t size() const { return photons.size(); }
+
+    double lookup_radius() const { return radius; }
+
+    // Caustic irradiance arriving at 'p' on a surface facing 'normal', estimated with a cone
+    // filter. A diffuse surface reflects base_color / pi of it.
+    Color irradiance(const Point3d& p, const Vector3d& normal) const {
+        if (photons.empty() || !bounds.contains(p)) {
+            return Color(0, 0, 0);
+        }
+
+        Color sum(0, 0, 0);
+        int64_t lo[3], hi[3];
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = cell(p[a] - radius);
+            hi[a] = cell(p[a] + radius);
+        }
+        for (auto x = lo[0]; x <= hi[0]; ++x) {
+            for (auto y = lo[1]; y <= hi[1]; ++y) {
+                for (auto z = lo[2]; z <= hi[2]; ++z) {
+                    auto found = cells.find(cell_key(x, y, z));
+                    if (found == cells.end()) {
+                        continue;
+                    }
+                    for (auto i = found->second.first; i < found->second.second; ++i) {
+                        const auto& photon = photons[i];
+                        auto offset = photon.p - p;
+                        auto distance = offset.length();
+                        // photons must arrive from the front, on this surface rather than one
+                        // just above or below it
+                        if (distance >= radius || dot(photon.direction, normal) >= 0 ||
+                            fabs(dot(offset, normal)) > 0.1 * radius) {
+                            continue;
+                        }
+                        sum += photon.power * (1 - distance / radius);
+                    }
+                }
+            }
+        }
+
+        // the cone filter integrates to a third of the disc's area
+        return sum * (3 / (pi * radius * radius));
+    }
+
+private:
+    std::vector<Photon> photons;
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> cells;  // photon index ranges
+    Aabb bounds;
+    double radius = 0;
+
+    // Photon 'index' of 'count'. Lights are picked by area and emit from both faces, as
+    // DiffuseLight does, with cosine-distributed directions.
+    static void trace(int index, int count, const Hittable& world, const HittableList& lights,
+                      const std::vector<double>& cdf, double total_area, int max_depth,
+                      std::vector<Photon>& found) {
+        SobolSampler sampler;
+        sampler.start(0, 0, index);
+
+        auto pick = sampler.get_1d() * total_area;
+        auto light = std::min<size_t>(std::upper_bound(cdf.begin(), cdf.end(), pick) - cdf.begin(),
+                                      cdf.size() - 1);
+
+        HitRecord origin;
+        lights.objects[light]->sample_surface(sampler.get_2d(), origin);
+        auto emitted = origin.mat->emitted(origin.u, origin.v, origin.p);
+
+        auto side = sampler.get_1d() < 0.5 ? 1.0 : -1.0;
+        Onb uvw;
+        uvw.build_from_w(side * origin.normal);
+        auto [u1, u2] = sampler.get_2d();
+        auto time = sampler.get_1d();
+        Ray r(origin.p, uvw.local(sample_cosine_direction(u1, u2)), time);
+
+        // flux over the pdf of the light, the point, the face and the direction
+        Color power = emitted * (2 * pi * total_area / count);
+
+        bool specular = false;
+        for (int depth = 0; depth < max_depth; ++depth) {
+            HitRecord rec;
+            if (!world.hit(r, Interval(0.001, infinity), rec)) {
+                return;
+            }
+
+            if (rec.mat->is_diffuse()) {
+                if (specular) {
+                    found.push_back({rec.p, unit_vector(r.direction()), power});
+                }
+                return;
+            }
+
+            ScatterRecord srec;
+            if (!rec.mat->sample(r, rec, srec, sampler) || !srec.is_specular) {
+                return;
+            }
+            power = power * srec.weight;
+            r = srec.scattered;
+            specular = true;
+        }
+    }
+
+    // The median, over a sample of photons, of the distance to their k-th nearest neighbour.
+    // Focused caustics are dense and stray reflections sparse, so a radius taken from the density
+    // of all photons together would blur the caustics that matter.
+    //
+    // Large maps are thinned to an evenly spaced subset first, which keeps the cost independent
+    // of the photon count. Thinning by a factor f spreads the photons on a surface f times more
+    // sparsely, so distances within the subset are scaled back by sqrt(f).
+    double typical_radius(int k) const {
+        if (photons.size() < 2) {
+            return 1e-6;
+        }
+
+        constexpr size_t subset_size = 16384;
+        auto stride = std::max<size_t>(1, photons.size() / subset_size);
+        std::vector<Point3d> subset;
+        subset.reserve(photons.size() / stride + 1);
+        for (size_t i = 0; i < photons.size(); i += stride) {
+            subset.push_back(photons[i].p);
+        }
+        auto thinning = static_cast<double>(photons.size()) / subset.size();
+        k = std::clamp<int>(k, 1, static_cast<int>(subset.size()) - 1);
+
+        constexpr size_t probes = 256;
+        auto step = std::max<size_t>(1, subset.size() / probes);
+        std::vector<double> kth;
+        std::vector<double> distances(subset.size());
+        for (size_t i = 0; i < subset.size(); i += step) {
+            for (size_t j = 0; j < subset.size(); ++j) {
+                distances[j] = (subset[j] - subset[i]).length_squared();
+            }
+            // the photon itself is at distance 0
+            std::nth_element(distances.begin(), distances.begin() + k, distances.end());
+            kth.push_back(sqrt(distances[k]));
+        }
+        std::nth_element(kth.begin(), kth.begin() + kth.size() / 2, kth.end());
+        return std::max(kth[kth.size() / 2] / sqrt(thinning), 1e-6);
+    }
+
+    int64_t cell(double x) const {
+        return static_cast<int64_t>(std::floor(x / (2 * radius)));
+    }
+
+    static uint64_t cell_key(int64_t x, int64_t y, int64_t z) {
+        uint32_t h = 0x2545f491u;
+        for (auto c : {x, y, z}) {
+            h = hash_combine(h, static_cast<uint32_t>(c));
+            h = hash_combine(h, static_cast<uint32_t>(c >> 32));
+        }
+        return (uint64_t(hash_u32(h ^ 0x9e3779b9u)) << 32) | h;
+    }
+
+    uint64_t key_of(const Photon& photon) const {
+        return cell_key(cell(photon.p.x()), cell(photon.p.y()), cell(photon.p.z()));
+    }
+
+    void build_grid() {
+        std::sort(photons.begin(), photons.end(), [this](const Photon& a, const Photon& b) {
+            return key_of(a) < key_of(b);
+        });
+        for (uint32_t i = 0; i < photons.size();) {
+            auto key = key_of(photons[i]);
+            auto end = i + 1;
+            while (end < photons.size() && key_of(photons[end]) == key) {
+                ++end;
+            }
+            cells[key] = {i, end};
+            i = end;
+        }
+    }
+};
+
+#endif  // PHOTON_MAP_H
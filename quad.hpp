@@ -12,6 +12,8 @@ public:
         normal = unit_vector(n);
         d = dot(normal, q);
         w = n / dot(n, n);
+        area = n.length();
+        inv_sqrt_area = 1 / sqrt(area);
 
         set_bounding_box();
     }
@@ -21,32 +23,69 @@ public:
     Aabb bounding_box() const override { return bbox; }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        if (fabs(denom) < 1e-8) {
+        double t, alpha, beta;
+        if (!plane_hit(r, ray_t, t, alpha, beta) || !is_interior(alpha, beta, rec)) {
             return false;
         }
 
-        auto t = (d - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t)) {
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.uv_per_unit = inv_sqrt_area;
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+
+        return true;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        double t, alpha, beta;
+        HitRecord scratch;  // only receives the planar coordinates from is_interior
+        return plane_hit(r, ray_t, t, alpha, beta) && is_interior(alpha, beta, scratch);
+    }
+
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
+        double t, alpha, beta;
+        HitRecord scratch;
+        if (!plane_hit(r, ray_t, t, alpha, beta) || !is_interior(alpha, beta, scratch)) {
             return false;
         }
 
-        auto intersection = r.at(t);
-        Vector3d planar_hitpoint = intersection - q;
-        auto alpha = dot(w, cross(planar_hitpoint, v));
-        auto beta = dot(w, cross(u, planar_hitpoint));
+        span = Interval(t, t);
+        return true;
+    }
 
-        if (!is_interior(alpha, beta, rec)) {
-            return false;
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        HitRecord rec;
+        if (!this->hit(Ray(origin, direction, 0), Interval(0.001, infinity), rec)) {
+            return 0;
         }
 
-        rec.t = t;
-        rec.p = intersection;
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+
+        return distance_squared / (cosine * area);
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        auto [a, b] = sampler.get_2d();
+        auto p = q + (a * u) + (b * v);
+        return p - origin;
+    }
+
+    double surface_area() const override { return area; }
+
+    void sample_surface(const std::array<double, 2>& uv, HitRecord& rec) const override {
+        rec.p = q + (uv[0] * u) + (uv[1] * v);
+        rec.normal = normal;
+        rec.front_face = true;
+        rec.u = uv[0];
+        rec.v = uv[1];
         rec.mat = mat;
-        rec.set_face_normal(r, normal);
+    }
 
-        return true;
+    double normal_cone(Vector3d& axis) const override {
+        axis = normal;
+        return 1;
     }
 
     virtual bool is_interior(double a, double b, HitRecord& rec) const {
@@ -67,6 +106,27 @@ private:
     Vector3d normal;
     double d;
     Vector3d w;
+    double area;
+    double inv_sqrt_area;
+
+    bool plane_hit(const Ray& r, Interval ray_t, double& t, double& alpha, double& beta) const {
+        auto denom = dot(normal, r.direction());
+
+        if (fabs(denom) < 1e-8) {
+            return false;
+        }
+
+        t = (d - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t)) {
+            return false;
+        }
+
+        Vector3d planar_hitpoint = r.at(t) - q;
+        alpha = dot(w, cross(planar_hitpoint, v));
+        beta = dot(w, cross(u, planar_hitpoint));
+
+        return true;
+    }
 };
 
 inline shared_ptr<HittableList> box(const Point3d& a, const Point3d& b, shared_ptr<Material> mat) {
@@ -0,0 +1,328 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "color.hpp"
+#include "render_session.hpp"
+
+// Serves a RenderSession on a local UNIX socket. Every connection gets its own thread and speaks a
+// line protocol; each request line gets one reply line, and images follow their reply line as a
+// plain PPM of the stated number of bytes.
+//
+//   load <id> <scene>        ok <objects>             build a scene or scene file and keep it
+//   drop <id>                ok
+//   scenes                   ok <id>...
+//   submit <id> [options]    job <n>                  queue a render
+//   render <id> [options]    job <n>, then as wait    queue a render and wait for it
+//   wait <n>                 image <n> <bytes>        or: cancelled <n>
+//   cancel <n>               ok
+//   shutdown                 ok                       stop serving once connections close
+//
+// Options are 'width <px>', 'spp <n>', 'depth <n>', 'priority <n>', 'vfov <deg>',
+// 'from <x> <y> <z>', 'at <x> <y> <z>', 'region <x0> <y0> <x1> <y1>' and 'progressive <seconds>'
+// (0 for no time limit). Progressive jobs send 'update <n> <samples> <bytes>' plus a PPM for each
+// preview on the connection that submitted them, as the previews are made. Failures are reported
+// as 'error <message>'.
+class RenderServer {
+public:
+    RenderServer(RenderSession& session, const std::string& path) : session(session), path(path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("socket path too long: " + path);
+        }
+        std::strcpy(address.sun_path, path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw std::runtime_error("could not create socket");
+        }
+        // a socket left by an earlier server is replaced; any other file at 'path' is not touched
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) {
+                close(listener);
+                throw std::runtime_error(path + " exists and is not a socket");
+            }
+            unlink(path.c_str());
+        }
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, 16) != 0) {
+            close(listener);
+            throw std::runtime_error("could not listen on " + path);
+        }
+    }
+
+    ~RenderServer() {
+        close(listener);
+        unlink(path.c_str());
+    }
+
+    // Accepts connections until a client sends 'shutdown', then waits for the open ones to close.
+    // Throws std::runtime_error, once the open connections have closed, if accepting fails for
+    // good.
+    void run() {
+        int failure = 0;
+        while (true) {
+            auto fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                auto error = errno;
+                std::unique_lock lock(mutex);
+                if (stopping) {
+                    break;
+                }
+                if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                    // out of descriptors or memory: retrying at once would spin, so give a
+                    // connection the chance to close first
+                    closed.wait_for(lock, std::chrono::milliseconds(100));
+                } else if (error != EINTR && error != ECONNABORTED) {
+                    failure = error;
+                    break;
+                }
+                continue;
+            }
+
+            // handlers are detached so a long-running server does not keep one stack per
+            // connection it ever had; 'open' counts them instead
+            {
+                std::lock_guard lock(mutex);
+                ++open;
+            }
+            std::thread([this, fd]() {
+                serve(std::make_shared<Connection>(fd));
+                std::lock_guard lock(mutex);
+                --open;
+                closed.notify_all();
+            }).detach();
+        }
+
+        std::unique_lock lock(mutex);
+        closed.wait(lock, [this]() { return open == 0; });
+        if (failure != 0) {
+            throw std::runtime_error(std::string("could not accept connections: ") +
+                                     std::strerror(failure));
+        }
+    }
+
+private:
+    // Replies and progressive updates may be sent from different threads.
+    class Connection {
+    public:
+        explicit Connection(int fd) : fd(fd) {}
+        ~Connection() { close(fd); }
+
+        const int fd;
+
+        // Holds back other senders, such as a job's updates until its 'job' reply has gone out.
+        std::unique_lock<std::recursive_mutex> hold() {
+            return std::unique_lock<std::recursive_mutex>(mutex);
+        }
+
+        void send(const std::string& line, const std::string& payload = "") {
+            auto lock = hold();
+            auto message = line + '\n' + payload;
+            for (size_t sent = 0; sent < message.size();) {
+                auto n = ::send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    return;  // the client is gone; the job still runs to completion
+                }
+                sent += n;
+            }
+        }
+
+    private:
+        std::recursive_mutex mutex;
+    };
+
+    RenderSession& session;
+    std::string path;
+    int listener;
+    std::mutex mutex;
+    std::condition_variable closed;  // signalled as each connection's handler finishes
+    int open = 0;                    // handlers still running
+    bool stopping = false;
+
+    void serve(std::shared_ptr<Connection> connection) {
+        std::set<int> jobs;  // submitted here and not yet waited for
+        std::string buffer;
+        char chunk[4096];
+
+        while (true) {
+            auto newline = buffer.find('\n');
+            if (newline == std::string::npos) {
+                auto n = recv(connection->fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    break;
+                }
+                buffer.append(chunk, n);
+                continue;
+            }
+
+            std::istringstream line(buffer.substr(0, newline));
+            buffer.erase(0, newline + 1);
+            try {
+                if (!handle(line, connection, jobs)) {
+                    break;
+                }
+            } catch (const std::exception& e) {
+                connection->send(std::string("error ") + e.what());
+            }
+        }
+
+        // nobody is left to collect the jobs of a closed connection
+        for (auto id : jobs) {
+            session.cancel(id);
+        }
+        for (auto id : jobs) {
+            try {
+                session.wait(id);
+            } catch (const std::exception&) {
+            }
+        }
+    }
+
+    // Returns false once the connection should close.
+    bool handle(std::istringstream& line, const std::shared_ptr<Connection>& connection,
+                std::set<int>& jobs) {
+        std::string command;
+        if (!(line >> command)) {
+            return true;
+        }
+
+        if (command == "load") {
+            std::string id, source;
+            line >> id >> source;
+            connection->send("ok " + std::to_string(session.load_scene(id, source)));
+        } else if (command == "drop") {
+            std::string id;
+            line >> id;
+            if (!session.drop_scene(id)) {
+                throw std::invalid_argument("unknown scene " + id);
+            }
+            connection->send("ok");
+        } else if (command == "scenes") {
+            std::string reply = "ok";
+            for (const auto& id : session.scene_ids()) {
+                reply += ' ' + id;
+            }
+            connection->send(reply);
+        } else if (command == "submit" || command == "render") {
+            auto id = submit(line, connection);
+            if (command == "render") {
+                send_result(id, *connection);
+            } else {
+                jobs.insert(id);
+            }
+        } else if (command == "wait") {
+            int id = -1;
+            line >> id;
+            if (!jobs.contains(id)) {
+                throw std::invalid_argument("unknown job " + std::to_string(id));
+            }
+            jobs.erase(id);
+            send_result(id, *connection);
+        } else if (command == "cancel") {
+            int id = -1;
+            line >> id;
+            if (!session.cancel(id)) {
+                throw std::invalid_argument("unknown or finished job " + std::to_string(id));
+            }
+            connection->send("ok");
+        } else if (command == "shutdown") {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            ::shutdown(listener, SHUT_RDWR);  // wakes the accept() in run()
+            connection->send("ok");
+            return false;
+        } else {
+            throw std::invalid_argument("unknown command " + command);
+        }
+        return true;
+    }
+
+    // Queues the request on 'line' and sends its 'job' reply.
+    int submit(std::istringstream& line, const std::shared_ptr<Connection>& connection) {
+        RenderRequest request;
+        line >> request.scene;
+
+        std::string option;
+        while (line >> option) {
+            if (option == "width") {
+                line >> request.width;
+            } else if (option == "spp") {
+                line >> request.samples_per_pixel;
+            } else if (option == "depth") {
+                line >> request.max_depth;
+            } else if (option == "priority") {
+                line >> request.priority;
+            } else if (option == "vfov") {
+                line >> request.vfov;
+            } else if (option == "from" || option == "at") {
+                double x, y, z;
+                line >> x >> y >> z;
+                (option == "from" ? request.look_from : request.look_at) = Point3d(x, y, z);
+            } else if (option == "region") {
+                auto& r = request.region;
+                line >> r.x0 >> r.y0 >> r.x1 >> r.y1;
+            } else if (option == "progressive") {
+                request.progressive = true;
+                line >> request.time_budget;
+            } else {
+                throw std::invalid_argument("unknown option " + option);
+            }
+            if (!line) {
+                throw std::invalid_argument("missing value for " + option);
+            }
+        }
+
+        // the callback keeps the connection open for as long as the job may call it
+        request.on_update = [connection](int id, const FrameBuffer& image) {
+            auto ppm = encode(image);
+            connection->send("update " + std::to_string(id) + ' ' + std::to_string(image.samples) +
+                                 ' ' + std::to_string(ppm.size()),
+                             ppm);
+        };
+
+        auto hold = connection->hold();
+        auto id = session.submit(std::move(request));
+        connection->send("job " + std::to_string(id));
+        return id;
+    }
+
+    void send_result(int id, Connection& connection) {
+        auto result = session.wait(id);
+        if (result.cancelled) {
+            connection.send("cancelled " + std::to_string(id));
+            return;
+        }
+        auto ppm = encode(result.image);
+        connection.send("image " + std::to_string(id) + ' ' + std::to_string(ppm.size()), ppm);
+    }
+
+    static std::string encode(const FrameBuffer& image) {
+        std::ostringstream out;
+        write_ppm(out, image.color, image.samples);
+        return out.str();
+    }
+};
+
+#endif  // RENDER_SERVER_H
@@ -0,0 +1,313 @@
+#ifndef RENDER_SESSION_H
+#define RENDER_SESSION_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "hittable_list.hpp"
+#include "light_bvh.hpp"
+#include "scene_io.hpp"
+#include "scenes.hpp"
+
+// A scene built once and kept for any number of renders: its BVH, its lights as a list and as the
+// tree the camera samples them through, the camera it specifies, and the description or mapping
+// the build read from.
+class LoadedScene {
+public:
+    // 'source' is a built-in scene name or a text or binary scene file. Throws std::runtime_error
+    // if there is no such scene or it does not build.
+    explicit LoadedScene(const std::string& source) {
+        SceneView scene;
+        if (builtin_scene(source, description)) {
+            scene = description.view();
+        } else if (MappedScene::is_binary(source)) {
+            mapped = std::make_unique<MappedScene>(source);
+            scene = mapped->view();
+        } else {
+            std::ifstream file(source);
+            if (!file) {
+                throw std::runtime_error("no built-in scene or scene file named '" + source + "'");
+            }
+            description = read_scene_text(file);
+            scene = description.view();
+        }
+
+        objects = scene.objects.size();
+        build_scene(scene, world, lights, camera);
+        light_tree = LightBvh(lights);
+    }
+
+    LoadedScene(const LoadedScene&) = delete;
+    LoadedScene& operator=(const LoadedScene&) = delete;
+
+    HittableList world;
+    HittableList lights;
+    LightBvh light_tree;
+    Camera camera;
+    size_t objects = 0;
+
+private:
+    SceneDescription description;
+    std::unique_ptr<MappedScene> mapped;
+};
+
+// One render of a loaded scene. Zero and empty values keep what the scene specifies.
+class RenderRequest {
+public:
+    std::string scene;
+    int priority = 0;  // higher runs first; equal priorities run in submission order
+    int width = 0;
+    int samples_per_pixel = 0;
+    int max_depth = 0;
+    double vfov = 0;
+    std::optional<Point3d> look_from;
+    std::optional<Point3d> look_at;
+    PixelRegion region;
+
+    // Progressive jobs hand every preview to 'on_update', with their job ID, and stop at
+    // samples_per_pixel or after time_budget seconds (0 for no limit).
+    bool progressive = false;
+    double time_budget = 0;
+    std::function<void(int, const FrameBuffer&)> on_update;
+};
+
+class RenderResult {
+public:
+    FrameBuffer image;  // partial if the job was cancelled while running
+    bool cancelled = false;
+};
+
+// Keeps scenes loaded, BVHs and all, under an ID and renders jobs against them from a priority
+// queue, one job at a time with every thread on it. A preview pays for neither process start-up nor
+// scene building, only for its own rays and the queue ahead of it. Jobs can be cancelled whether
+// queued or running. All members are thread-safe.
+class RenderSession {
+public:
+    // Every job renders with 'sampler'.
+    explicit RenderSession(int threads = 4, SamplerType sampler = SamplerType::sobol)
+        : threads(std::max(1, threads)), sampler(sampler) {
+        scheduler = std::thread([this]() { run(); });
+    }
+
+    // Cancels every outstanding job and waits for the one running.
+    ~RenderSession() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            for (auto& [id, job] : jobs) {
+                job->cancel = true;
+            }
+        }
+        wake.notify_all();
+        scheduler.join();
+    }
+
+    // Builds 'source' and keeps it as 'id', replacing any scene of that ID; jobs already holding
+    // the old one finish with it. Returns the object count.
+    size_t load_scene(const std::string& id, const std::string& source) {
+        auto scene = std::make_shared<const LoadedScene>(source);
+        std::lock_guard lock(mutex);
+        scenes[id] = scene;
+        return scene->objects;
+    }
+
+    bool drop_scene(const std::string& id) {
+        std::lock_guard lock(mutex);
+        return scenes.erase(id) > 0;
+    }
+
+    std::vector<std::string> scene_ids() const {
+        std::lock_guard lock(mutex);
+        std::vector<std::string> ids;
+        for (const auto& [id, scene] : scenes) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    // Queues a render and returns its job ID. Throws std::invalid_argument for an unknown scene.
+    int submit(RenderRequest request) {
+        std::lock_guard lock(mutex);
+        auto scene = scenes.find(request.scene);
+        if (scene == scenes.end()) {
+            throw std::invalid_argument("unknown scene " + request.scene);
+        }
+
+        auto job = std::make_shared<Job>();
+        job->id = next_id++;
+        job->scene = scene->second;
+        job->request = std::move(request);
+        job->result = job->promise.get_future().share();
+
+        jobs[job->id] = job;
+        queue.push(job);
+        wake.notify_one();
+        return job->id;
+    }
+
+    // Returns false if there is no such job or it has already finished.
+    bool cancel(int id) {
+        std::lock_guard lock(mutex);
+        auto job = jobs.find(id);
+        if (job == jobs.end() || job->second->done) {
+            return false;
+        }
+        job->second->cancel = true;
+        return true;
+    }
+
+    // Blocks until the job is done and forgets it. Rethrows anything the render threw.
+    RenderResult wait(int id) {
+        std::shared_future<RenderResult> result;
+        {
+            std::lock_guard lock(mutex);
+            auto job = jobs.find(id);
+            if (job == jobs.end()) {
+                throw std::invalid_argument("unknown job " + std::to_string(id));
+            }
+            result = job->second->result;
+        }
+
+        result.wait();
+        {
+            std::lock_guard lock(mutex);
+            jobs.erase(id);
+        }
+        return result.get();
+    }
+
+private:
+    struct Job {
+        int id;
+        std::shared_ptr<const LoadedScene> scene;
+        RenderRequest request;
+        std::atomic<bool> cancel = false;
+        bool done = false;  // the promise is set; guarded by the session mutex
+        std::promise<RenderResult> promise;
+        std::shared_future<RenderResult> result;
+    };
+
+    struct LaterJob {
+        bool operator()(const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) const {
+            if (a->request.priority != b->request.priority) {
+                return a->request.priority < b->request.priority;
+            }
+            return a->id > b->id;
+        }
+    };
+
+    int threads;
+    SamplerType sampler;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::map<std::string, std::shared_ptr<const LoadedScene>> scenes;
+    std::map<int, std::shared_ptr<Job>> jobs;  // submitted and not yet waited for
+    std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job>>, LaterJob> queue;
+    int next_id = 1;
+    bool stopping = false;
+    std::thread scheduler;
+
+    void run() {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                job = queue.top();
+                queue.pop();
+            }
+
+            std::optional<RenderResult> result;
+            std::exception_ptr failure;
+            try {
+                result = execute(*job);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+
+            // marked done under the lock, so cancel() never claims to stop a finished job
+            std::lock_guard lock(mutex);
+            job->done = true;
+            if (failure) {
+                job->promise.set_exception(failure);
+            } else {
+                job->promise.set_value(std::move(*result));
+            }
+        }
+    }
+
+    RenderResult execute(Job& job) {
+        RenderResult result;
+        if (job.cancel) {
+            result.cancelled = true;
+            return result;
+        }
+
+        const auto& request = job.request;
+        const auto& scene = *job.scene;
+        auto cam = scene.camera;
+        if (request.width > 0) cam.image_width = request.width;
+        if (request.samples_per_pixel > 0) cam.samples_per_pixel = request.samples_per_pixel;
+        if (request.max_depth > 0) cam.max_depth = request.max_depth;
+        if (request.vfov > 0) cam.vfov = request.vfov;
+        if (request.look_from) cam.look_from = *request.look_from;
+        if (request.look_at) cam.look_at = *request.look_at;
+        cam.sampler_type = sampler;
+        cam.region = request.region;
+        cam.cancel = &job.cancel;
+
+        if (request.progressive) {
+            ProgressiveSettings settings;
+            settings.time_budget = request.time_budget;
+            settings.threads = threads;
+            auto publish = [&](const FrameBuffer& fb) {
+                if (request.on_update) {
+                    request.on_update(job.id, fb);
+                }
+            };
+            result.image = cam.render_progressive(scene.world, scene.light_tree, settings, publish);
+        } else {
+            // the samples are split across the threads as in main(), each taking its own range
+            auto total = cam.samples_per_pixel;
+            auto workers = std::max(1, std::min(threads, total));
+            cam.sample_count = total;
+            std::vector<std::future<FrameBuffer>> partials;
+            for (int t = 0, offset = 0; t < workers; ++t) {
+                cam.samples_per_pixel = total / workers + (t < total % workers ? 1 : 0);
+                cam.sample_offset = offset;
+                offset += cam.samples_per_pixel;
+                partials.push_back(std::async(std::launch::async, [&scene, cam]() mutable {
+                    return cam.render(scene.world, scene.light_tree);
+                }));
+            }
+
+            result.image = partials[0].get();
+            for (int t = 1; t < workers; ++t) {
+                result.image += partials[t].get();
+            }
+        }
+
+        result.cancelled = job.cancel;
+        return result;
+    }
+};
+
+#endif  // RENDER_SESSION_H
@@ -6,7 +6,9 @@
 #endif  // _MSC_VER
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
@@ -24,21 +26,30 @@ public:
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
 
+        auto path = find(image_filename);
+        if (!path.empty() && load(path)) return;
+
+        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    }
+
+    // Hunts for the image file in the locations described above and returns the first path that
+    // can be opened, or an empty string.
+    static std::string find(const char* image_filename) {
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
 
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
+        if (imagedir && readable(std::string(imagedir) + "/" + filename)) {
+            return std::string(imagedir) + "/" + filename;
+        }
+        if (readable(filename)) return filename;
 
-        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+        std::string prefix = "images/";
+        for (int level = 0; level <= 6; ++level) {
+            if (readable(prefix + filename)) return prefix + filename;
+            prefix = "../" + prefix;
+        }
+
+        return "";
     }
 
     ~RtwImage() { STBI_FREE(data); }
@@ -71,6 +82,8 @@ private:
     int image_width, image_height;
     int bytes_per_scanline;
 
+    static bool readable(const std::string& path) { return std::ifstream(path).good(); }
+
     static int clamp(int x, int low, int high) {
         if (x < low) {
             return low;
@@ -0,0 +1,382 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtweekend.hpp"
+
+// Sample sources for the integrator. A sampler is positioned on one sample of one pixel with
+// start() and then hands out the coordinates of that sample dimension by dimension. The caller
+// assigns the dimensions explicitly with set_dimension(), so a given decision (lens position,
+// light choice at bounce 2, ...) always reads the same dimension of the sequence no matter how
+// many values earlier stages consumed. Values come from hashes of the pixel, sample index and
+// dimension rather than shared state, so samplers are cheap to create and need no locking.
+
+enum class SamplerType { independent, stratified, sobol, blue_noise };
+
+inline uint32_t hash_u32(uint32_t x) {
+    // lowbias32 by Chris Wellons
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+    return hash_u32(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline double to_unit(uint32_t x) { return x * 0x1p-32; }
+
+class Sampler {
+public:
+    virtual ~Sampler() = default;
+
+    // Positions the sampler on sample 'index' of pixel (i, j) and resets the dimension to 0.
+    virtual void start(int i, int j, int index) {
+        pixel_x = i;
+        pixel_y = j;
+        sample_index = index;
+        dimension = 0;
+    }
+
+    void set_dimension(int d) { dimension = d; }
+
+    virtual double get_1d() = 0;
+
+    virtual std::array<double, 2> get_2d() = 0;
+
+protected:
+    int pixel_x = 0, pixel_y = 0;
+    int sample_index = 0;
+    int dimension = 0;
+
+    uint32_t pixel_seed(uint32_t salt) const {
+        return hash_combine(hash_combine(hash_combine(salt, pixel_x), pixel_y), dimension);
+    }
+};
+
+// Uncorrelated pseudo-random values: the reference the other samplers are measured against.
+class IndependentSampler : public Sampler {
+public:
+    double get_1d() override {
+        auto h = hash_combine(pixel_seed(0x51ed270bu), sample_index);
+        ++dimension;
+        return to_unit(h);
+    }
+
+    std::array<double, 2> get_2d() override {
+        auto h = hash_combine(pixel_seed(0x51ed270bu), sample_index);
+        ++dimension;
+        return {to_unit(h), to_unit(hash_u32(h))};
+    }
+};
+
+// Kensler's hash-based permutation of [0, n): maps i to a distinct value for every seed.
+inline int kensler_permute(uint32_t i, uint32_t n, uint32_t seed) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return static_cast<int>((i + seed) % n);
+}
+
+// Jittered strata: the 'count' samples of a pixel fall in distinct strata of every dimension (a
+// grid of nx by ny cells for 2D). The order of the strata is shuffled per pixel and dimension so
+// dimensions are not correlated with each other.
+class StratifiedSampler : public Sampler {
+public:
+    StratifiedSampler(int count) : count(count < 1 ? 1 : count) {
+        nx = static_cast<int>(sqrt(static_cast<double>(this->count)));
+        ny = (this->count + nx - 1) / nx;
+    }
+
+    double get_1d() override {
+        auto seed = pixel_seed(0x2c1b3c6du);
+        ++dimension;
+        auto stratum = kensler_permute(sample_index % count, count, seed);
+        return (stratum + to_unit(hash_combine(seed, sample_index))) / count;
+    }
+
+    std::array<double, 2> get_2d() override {
+        auto seed = pixel_seed(0x297a2d39u);
+        ++dimension;
+        auto cell = kensler_permute(sample_index % count, nx * ny, seed);
+        auto h = hash_combine(seed, sample_index);
+        return {((cell % nx) + to_unit(h)) / nx, ((cell / nx) + to_unit(hash_u32(h))) / ny};
+    }
+
+private:
+    int count, nx, ny;
+};
+
+// Owen-scrambled Sobol points, padded per dimension pair (Burley, "Practical Hash-based Owen
+// Scrambling", 2020). Every 1D or 2D request uses the first two Sobol dimensions with an index
+// shuffled and scrambled by a seed derived from the dimension, which keeps each pair well
+// stratified for any sample count and progressive in the sample index.
+class SobolSampler : public Sampler {
+public:
+    // 'per_pixel' gives every pixel its own scramble; otherwise all pixels share the point set,
+    // which the blue-noise sampler relies on.
+    SobolSampler(bool per_pixel = true) : per_pixel(per_pixel) {}
+
+    double get_1d() override {
+        auto seed = seed_for_dimension();
+        auto index = nested_uniform_scramble(sample_index, seed);
+        return to_unit(nested_uniform_scramble(sobol_0(index), hash_u32(seed)));
+    }
+
+    std::array<double, 2> get_2d() override {
+        auto seed = seed_for_dimension();
+        auto index = nested_uniform_scramble(sample_index, seed);
+        return {to_unit(nested_uniform_scramble(sobol_0(index), hash_combine(seed, 0))),
+                to_unit(nested_uniform_scramble(sobol_1(index), hash_combine(seed, 1)))};
+    }
+
+private:
+    bool per_pixel;
+
+    uint32_t seed_for_dimension() {
+        auto seed = per_pixel ? pixel_seed(0x68e31da4u) : hash_combine(0x68e31da4u, dimension);
+        ++dimension;
+        return seed;
+    }
+
+    static uint32_t reverse_bits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+        return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+    }
+
+    // The first Sobol dimension is the van der Corput sequence.
+    static uint32_t sobol_0(uint32_t index) { return reverse_bits(index); }
+
+    // The second has direction numbers v_0 = 1/2, v_k = v_(k-1) xor v_(k-1) / 2.
+    static uint32_t sobol_1(uint32_t index) {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+            if (index & 1) {
+                result ^= v;
+            }
+        }
+        return result;
+    }
+};
+
+// Tileable 64x64 blue-noise threshold mask built once by void-and-cluster (Ulichney 1993).
+class BlueNoiseMask {
+public:
+    static constexpr int size = 64;
+
+    static const BlueNoiseMask& instance() {
+        static BlueNoiseMask mask;
+        return mask;
+    }
+
+    // Rank of the pixel in [0, 1), wrapping around the tile.
+    double at(int x, int y) const {
+        return rank[((y % size + size) % size) * size + ((x % size + size) % size)];
+    }
+
+private:
+    std::vector<double> rank;
+
+    BlueNoiseMask() : rank(size * size) {
+        constexpr int n = size * size;
+        constexpr double sigma = 1.9;
+
+        // toroidal Gaussian splat, indexed by wrapped offset
+        std::vector<double> kernel(n);
+        for (int dy = 0; dy < size; ++dy) {
+            for (int dx = 0; dx < size; ++dx) {
+                auto wx = std::min(dx, size - dx), wy = std::min(dy, size - dy);
+                kernel[dy * size + dx] = exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> pattern(n, 0);
+        std::vector<double> energy(n, 0);
+        auto splat = [&](int p, double sign) {
+            auto px = p % size, py = p / size;
+            for (int y = 0; y < size; ++y) {
+                auto ky = ((y - py + size) % size) * size;
+                for (int x = 0; x < size; ++x) {
+                    energy[y * size + x] += sign * kernel[ky + (x - px + size) % size];
+                }
+            }
+        };
+        auto extreme = [&](char value, bool largest) {
+            int best = -1;
+            for (int p = 0; p < n; ++p) {
+                if (pattern[p] == value &&
+                    (best < 0 || (largest ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+                    best = p;
+                }
+            }
+            return best;
+        };
+
+        // initial binary pattern: a tenth of the pixels, relaxed until the tightest cluster and
+        // the largest void coincide
+        auto ones = n / 10;
+        for (uint32_t i = 0, placed = 0; placed < static_cast<uint32_t>(ones); ++i) {
+            auto p = hash_u32(i) % n;
+            if (!pattern[p]) {
+                pattern[p] = 1;
+                splat(p, 1);
+                ++placed;
+            }
+        }
+        while (true) {
+            auto cluster = extreme(1, true);
+            pattern[cluster] = 0;
+            splat(cluster, -1);
+            auto gap = extreme(0, false);
+            pattern[gap] = 1;
+            splat(gap, 1);
+            if (gap == cluster) {
+                break;
+            }
+        }
+
+        auto prototype = pattern;
+        auto prototype_energy = energy;
+
+        // ranks below the prototype: remove the tightest clusters
+        for (int r = ones - 1; r >= 0; --r) {
+            auto cluster = extreme(1, true);
+            pattern[cluster] = 0;
+            splat(cluster, -1);
+            rank[cluster] = r;
+        }
+
+        // ranks above it: fill the largest voids
+        pattern = prototype;
+        energy = prototype_energy;
+        for (int r = ones; r < n; ++r) {
+            auto gap = extreme(0, false);
+            pattern[gap] = 1;
+            splat(gap, 1);
+            rank[gap] = r;
+        }
+
+        for (auto& r : rank) {
+            r = (r + 0.5) / n;
+        }
+    }
+};
+
+// Sobol points shared by all pixels, shifted per pixel (Cranley-Patterson rotation) by a blue-
+// noise mask. Neighbouring pixels then make complementary errors, so the remaining noise sits at
+// high spatial frequencies where it is less visible and easier to filter.
+class BlueNoiseSampler : public Sampler {
+public:
+    BlueNoiseSampler() : sobol(false), mask(BlueNoiseMask::instance()) {}
+
+    void start(int i, int j, int index) override {
+        Sampler::start(i, j, index);
+        sobol.start(i, j, index);
+    }
+
+    double get_1d() override {
+        sobol.set_dimension(dimension);
+        auto u = shift(sobol.get_1d(), 0);
+        ++dimension;
+        return u;
+    }
+
+    std::array<double, 2> get_2d() override {
+        sobol.set_dimension(dimension);
+        auto [u1, u2] = sobol.get_2d();
+        std::array<double, 2> u = {shift(u1, 0), shift(u2, 1)};
+        ++dimension;
+        return u;
+    }
+
+private:
+    SobolSampler sobol;
+    const BlueNoiseMask& mask;
+
+    // Each dimension and coordinate reads the mask at its own pseudo-random tile offset.
+    double shift(double u, uint32_t coordinate) const {
+        auto h = hash_combine(hash_combine(0x1b873593u, dimension), coordinate);
+        auto x = pixel_x + static_cast<int>(h & 63), y = pixel_y + static_cast<int>((h >> 6) & 63);
+        auto shifted = u + mask.at(x, y);
+        return shifted - floor(shifted);
+    }
+};
+
+inline std::unique_ptr<Sampler> make_sampler(SamplerType type, int samples_per_pixel) {
+    switch (type) {
+        case SamplerType::independent:
+            return std::make_unique<IndependentSampler>();
+        case SamplerType::stratified:
+            return std::make_unique<StratifiedSampler>(samples_per_pixel);
+        case SamplerType::blue_noise:
+            return std::make_unique<BlueNoiseSampler>();
+        default:
+            return std::make_unique<SobolSampler>();
+    }
+}
+
+// Parses a sampler name as accepted on the command line. Returns false for unknown names.
+inline bool parse_sampler(const std::string& name, SamplerType& type) {
+    if (name == "independent") {
+        type = SamplerType::independent;
+    } else if (name == "stratified") {
+        type = SamplerType::stratified;
+    } else if (name == "sobol") {
+        type = SamplerType::sobol;
+    } else if (name == "blue_noise") {
+        type = SamplerType::blue_noise;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif  // SAMPLER_H
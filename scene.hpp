@@ -0,0 +1,489 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "constant_medium.hpp"
+#include "heterogeneous_medium.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "perf_counters.hpp"
+#include "quad.hpp"
+#include "rtweekend.hpp"
+#include "sphere.hpp"
+#include "trace.hpp"
+#include "texture.hpp"
+#include "volume.hpp"
+
+// Scene description: flat tables of plain records that reference each other by index. The same
+// records back the in-memory builder, the text format and the memory-mapped binary format (see
+// scene_io.hpp), so a mapped file is used in place without any per-object parsing.
+
+enum class TextureType : int32_t { solid, checker, image, noise };
+enum class MaterialType : int32_t { lambertian, metal, dielectric, light, isotropic };
+enum class ShapeType : int32_t { sphere, quad, box };
+enum class MediumType : int32_t { none, constant, cloud };
+
+class CameraDesc {
+public:
+    double aspect_ratio = 1.0;
+    int32_t image_width = 100;
+    int32_t samples_per_pixel = 10;
+    int32_t max_depth = 10;
+    int32_t reserved = 0;
+    Color background;
+    double vfov = 90;
+    Point3d look_from = Point3d(0, 0, -1);
+    Point3d look_at = Point3d(0, 0, 0);
+    Vector3d v_up = Vector3d(0, 1, 0);
+    double defocus_angle = 0;
+    double focus_dist = 10;
+};
+
+class TextureDesc {
+public:
+    TextureType type;
+    int32_t name;        // image file, an offset into the string table
+    double scale;        // checker cell size or noise frequency
+    Color even;          // solid color, or the first checker color
+    Color odd;
+    int32_t resolution;  // noise baked into a grid of this many samples per axis; 0 for exact
+    int32_t reserved;
+    Point3d bake_min;    // the box the noise is baked over
+    Point3d bake_max;
+};
+
+class MaterialDesc {
+public:
+    MaterialType type;
+    int32_t texture;  // lambertian, light and isotropic
+    Color color;      // metal albedo
+    double param;     // metal fuzz or dielectric index of refraction
+};
+
+// Objects are collected per group. A group is built into a HittableList (or a BVH over it), rotated
+// about y, translated and added to its parent; group 0 is the world. Parents precede children.
+class GroupDesc {
+public:
+    int32_t parent;
+    int32_t bvh;
+    double rotate_y;  // degrees
+    Vector3d translate;
+};
+
+// A sphere (p0 center at time 0, p1 at time 1), a quad (p0 corner, p1 and p2 edges) or a box
+// (p0 and p1 opposite corners). With a medium the shape is only the boundary of a volume.
+class ObjectDesc {
+public:
+    ShapeType shape;
+    int32_t group;
+    int32_t material;
+    int32_t light;  // also sampled by next-event estimation; group 0 only
+    Point3d p0, p1, p2;
+    double radius;
+    MediumType medium;
+    int32_t grid_resolution;  // cloud voxels per axis
+    double density;           // constant density, or the cloud's density scale
+    double frequency;         // cloud noise frequency
+    Color albedo;             // medium albedo
+};
+
+static_assert(std::is_trivially_copyable_v<CameraDesc> &&
+              std::is_trivially_copyable_v<TextureDesc> &&
+              std::is_trivially_copyable_v<MaterialDesc> &&
+              std::is_trivially_copyable_v<GroupDesc> && std::is_trivially_copyable_v<ObjectDesc>);
+
+// Read-only view of a scene's tables, either owned by a SceneDescription or mapped from a file.
+class SceneView {
+public:
+    const CameraDesc* camera = nullptr;
+    std::span<const TextureDesc> textures;
+    std::span<const MaterialDesc> materials;
+    std::span<const GroupDesc> groups;
+    std::span<const ObjectDesc> objects;
+    std::span<const char> strings;  // null-terminated names
+
+    const char* string(int32_t offset) const {
+        if (offset < 0 || static_cast<size_t>(offset) >= strings.size()) {
+            throw std::runtime_error("scene string offset out of range");
+        }
+        return strings.data() + offset;
+    }
+};
+
+class SceneDescription {
+public:
+    CameraDesc camera;
+    std::vector<TextureDesc> textures;
+    std::vector<MaterialDesc> materials;
+    std::vector<GroupDesc> groups;
+    std::vector<ObjectDesc> objects;
+    std::vector<char> strings;
+
+    SceneDescription() { add_group(-1); }
+
+    SceneView view() const { return {&camera, textures, materials, groups, objects, strings}; }
+
+    int solid(const Color& c) {
+        auto t = texture_record(TextureType::solid);
+        t.even = c;
+        return add_texture(t);
+    }
+
+    int checker(double scale, const Color& even, const Color& odd) {
+        auto t = texture_record(TextureType::checker);
+        t.scale = scale;
+        t.even = even;
+        t.odd = odd;
+        return add_texture(t);
+    }
+
+    int image(const std::string& filename) {
+        auto t = texture_record(TextureType::image);
+        t.name = static_cast<int32_t>(strings.size());
+        strings.insert(strings.end(), filename.begin(), filename.end());
+        strings.push_back('\0');
+        return add_texture(t);
+    }
+
+    int noise(double scale) {
+        auto t = texture_record(TextureType::noise);
+        t.scale = scale;
+        return add_texture(t);
+    }
+
+    // Noise precomputed over the box from 'min' to 'max' at resolution^3 samples and interpolated
+    // there, for static scenes whose noisy surfaces lie within the box.
+    int baked_noise(double scale, int resolution, const Point3d& min, const Point3d& max) {
+        auto t = texture_record(TextureType::noise);
+        t.scale = scale;
+        t.resolution = resolution;
+        t.bake_min = min;
+        t.bake_max = max;
+        return add_texture(t);
+    }
+
+    int lambertian(int texture) {
+        return add_material({MaterialType::lambertian, texture, Color(), 0});
+    }
+
+    int lambertian(const Color& c) { return lambertian(solid(c)); }
+
+    int metal(const Color& c, double fuzz) {
+        return add_material({MaterialType::metal, -1, c, fuzz});
+    }
+
+    int dielectric(double ior) {
+        return add_material({MaterialType::dielectric, -1, Color(), ior});
+    }
+
+    int light(const Color& c) { return add_material({MaterialType::light, solid(c), Color(), 0}); }
+
+    int isotropic(const Color& c) {
+        return add_material({MaterialType::isotropic, solid(c), Color(), 0});
+    }
+
+    int add_group(int parent, bool bvh = false, double rotate_y = 0,
+                  const Vector3d& translate = Vector3d()) {
+        groups.push_back({parent, bvh, rotate_y, translate});
+        return static_cast<int>(groups.size()) - 1;
+    }
+
+    int sphere(int group, int material, const Point3d& center, double radius) {
+        return moving_sphere(group, material, center, center, radius);
+    }
+
+    int moving_sphere(int group, int material, const Point3d& center1, const Point3d& center2,
+                      double radius) {
+        return add_object(ShapeType::sphere, group, material, center1, center2, Point3d(), radius);
+    }
+
+    int quad(int group, int material, const Point3d& q, const Vector3d& u, const Vector3d& v) {
+        return add_object(ShapeType::quad, group, material, q, u, v, 0);
+    }
+
+    int box(int group, int material, const Point3d& a, const Point3d& b) {
+        return add_object(ShapeType::box, group, material, a, b, Point3d(), 0);
+    }
+
+    // Turns an object into the boundary of a homogeneous medium.
+    void constant_medium(int object, double density, const Color& albedo) {
+        auto& o = objects[object];
+        o.medium = MediumType::constant;
+        o.density = density;
+        o.albedo = albedo;
+    }
+
+    // Turns an object into the boundary of a Perlin noise cloud filling its bounding box.
+    void cloud_medium(int object, double density_scale, const Color& albedo, int resolution,
+                      double frequency) {
+        auto& o = objects[object];
+        o.medium = MediumType::cloud;
+        o.density = density_scale;
+        o.albedo = albedo;
+        o.grid_resolution = resolution;
+        o.frequency = frequency;
+    }
+
+private:
+    // A record of 'type' with every other field zero and no image name.
+    static TextureDesc texture_record(TextureType type) {
+        TextureDesc t{};
+        t.type = type;
+        t.name = -1;
+        return t;
+    }
+
+    int add_texture(const TextureDesc& t) {
+        textures.push_back(t);
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    int add_material(const MaterialDesc& m) {
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    int add_object(ShapeType shape, int group, int material, const Point3d& p0, const Point3d& p1,
+                   const Point3d& p2, double radius) {
+        objects.push_back(
+            {shape, group, material, 0, p0, p1, p2, radius, MediumType::none, 0, 0, 0, Color()});
+        return static_cast<int>(objects.size()) - 1;
+    }
+};
+
+// Checks what the tables' users index by without bounds checks of their own: the camera settings
+// the image size and ray setup divide by, the enums, which name tables and switches assume are in
+// range, and the resolution of baked noise and cloud grids.
+// Throws std::runtime_error naming the first problem.
+inline void validate_scene(const SceneView& scene) {
+    auto check = [](bool ok, const char* what) {
+        if (!ok) {
+            throw std::runtime_error(std::string("invalid scene: ") + what);
+        }
+    };
+    auto in_range = [](auto value, auto last) {
+        return static_cast<int32_t>(value) >= 0 &&
+               static_cast<int32_t>(value) <= static_cast<int32_t>(last);
+    };
+
+    check(scene.camera != nullptr, "missing camera");
+    const auto& cam = *scene.camera;
+    check(std::isfinite(cam.aspect_ratio) && cam.aspect_ratio > 0,
+          "camera aspect ratio must be positive");
+    check(cam.image_width >= 1, "camera image width must be at least 1");
+    check(cam.image_width / cam.aspect_ratio < std::numeric_limits<int32_t>::max(),
+          "camera image height out of range");
+    check(cam.samples_per_pixel >= 1, "camera samples per pixel must be at least 1");
+    check(cam.max_depth >= 1, "camera max depth must be at least 1");
+    check(cam.vfov > 0 && cam.vfov < 180, "camera vertical field of view must be in (0, 180)");
+    check(std::isfinite(cam.focus_dist) && cam.focus_dist > 0,
+          "camera focus distance must be positive");
+    check(std::isfinite(cam.defocus_angle) && cam.defocus_angle >= 0,
+          "camera defocus angle must not be negative");
+    for (const auto& t : scene.textures) {
+        check(in_range(t.type, TextureType::noise), "unknown texture type");
+        check(t.type != TextureType::noise || t.resolution == 0 || t.resolution >= 2,
+              "baked noise resolution must be 0 or at least 2");
+        check(t.type != TextureType::noise || t.resolution == 0 ||
+                  (t.bake_min.x() < t.bake_max.x() && t.bake_min.y() < t.bake_max.y() &&
+                   t.bake_min.z() < t.bake_max.z()),
+              "baked noise box must have a positive size");
+    }
+    for (const auto& m : scene.materials) {
+        check(in_range(m.type, MaterialType::isotropic), "unknown material type");
+    }
+    for (const auto& o : scene.objects) {
+        check(in_range(o.shape, ShapeType::box), "unknown shape type");
+        check(in_range(o.medium, MediumType::cloud), "unknown medium type");
+        check(o.medium != MediumType::cloud || o.grid_resolution >= 2,
+              "cloud grid resolution must be at least 2");
+    }
+}
+
+// The RenderFeature bits a scene needs beyond what the camera settings decide. Assumes the scene
+// has been validated by build_scene().
+inline unsigned scene_features(const SceneView& scene) {
+    unsigned features = 0;
+    for (const auto& o : scene.objects) {
+        if (o.shape == ShapeType::sphere && (o.p1 - o.p0).length_squared() > 0) {
+            features |= feature_bit(RenderFeature::motion_blur);
+        }
+        if (scene.materials[o.material].type == MaterialType::light) {
+            features |= feature_bit(RenderFeature::emission);
+        }
+        if (o.medium != MediumType::none) {
+            features |= feature_bit(RenderFeature::volumes);
+        }
+    }
+    return features;
+}
+
+// Instantiates a scene: fills 'world' and 'lights' and applies the camera settings. Throws
+// std::runtime_error on dangling indices, values validate_scene() rejects or an unsupported layout.
+inline void build_scene(const SceneView& scene, HittableList& world, HittableList& lights,
+                        Camera& cam) {
+    validate_scene(scene);
+    auto check = [](bool ok, const char* what) {
+        if (!ok) {
+            throw std::runtime_error(std::string("invalid scene: ") + what);
+        }
+    };
+    auto index = [&](int32_t i, size_t count, const char* what) {
+        check(i >= 0 && static_cast<size_t>(i) < count, what);
+        return static_cast<size_t>(i);
+    };
+
+    std::vector<shared_ptr<Texture>> textures;
+    textures.reserve(scene.textures.size());
+    for (const auto& t : scene.textures) {
+        switch (t.type) {
+            case TextureType::solid:
+                textures.push_back(make_shared<SolidColor>(t.even));
+                break;
+            case TextureType::checker:
+                textures.push_back(make_shared<CheckerTexture>(t.scale, t.even, t.odd));
+                break;
+            case TextureType::image:
+                textures.push_back(make_shared<ImageTexture>(scene.string(t.name)));
+                break;
+            case TextureType::noise:
+                if (t.resolution > 0) {
+                    auto baked = make_shared<NoiseTexture>(
+                        t.scale, Aabb(t.bake_min, t.bake_max), t.resolution);
+                    std::clog << "Baked noise texture " << textures.size() << " at "
+                              << t.resolution << "^3: max error " << baked->bake_error().max
+                              << ", rms error " << baked->bake_error().rms << '\n';
+                    textures.push_back(baked);
+                } else {
+                    textures.push_back(make_shared<NoiseTexture>(t.scale));
+                }
+                break;
+            default:
+                check(false, "unknown texture type");
+        }
+    }
+
+    std::vector<shared_ptr<Material>> materials;
+    materials.reserve(scene.materials.size());
+    for (const auto& m : scene.materials) {
+        switch (m.type) {
+            case MaterialType::lambertian:
+                materials.push_back(make_shared<Lambertian>(
+                    textures[index(m.texture, textures.size(), "material texture")]));
+                break;
+            case MaterialType::metal:
+                materials.push_back(make_shared<Metal>(m.color, m.param));
+                break;
+            case MaterialType::dielectric:
+                materials.push_back(make_shared<Dielectric>(m.param));
+                break;
+            case MaterialType::light:
+                materials.push_back(make_shared<DiffuseLight>(
+                    textures[index(m.texture, textures.size(), "material texture")]));
+                break;
+            case MaterialType::isotropic:
+                materials.push_back(make_shared<Isotropic>(
+                    textures[index(m.texture, textures.size(), "material texture")]));
+                break;
+            default:
+                check(false, "unknown material type");
+        }
+    }
+
+    check(!scene.groups.empty() && scene.groups[0].parent < 0, "group 0 must be the root");
+    std::vector<HittableList> groups(scene.groups.size());
+
+    for (const auto& o : scene.objects) {
+        auto group = index(o.group, groups.size(), "object group");
+        auto mat = materials[index(o.material, materials.size(), "object material")];
+
+        shared_ptr<Hittable> object;
+        switch (o.shape) {
+            case ShapeType::sphere:
+                if ((o.p1 - o.p0).length_squared() == 0) {
+                    object = make_shared<Sphere>(o.p0, o.radius, mat);
+                } else {
+                    object = make_shared<Sphere>(o.p0, o.p1, o.radius, mat);
+                }
+                break;
+            case ShapeType::quad:
+                object = make_shared<Quad>(o.p0, o.p1, o.p2, mat);
+                break;
+            case ShapeType::box:
+                object = box(o.p0, o.p1, mat);
+                break;
+            default:
+                check(false, "unknown shape type");
+        }
+
+        if (o.medium == MediumType::constant) {
+            object = make_shared<ConstantMedium>(object, o.density, o.albedo);
+        } else if (o.medium == MediumType::cloud) {
+            auto grid = DensityGrid::noise_cloud(object->bounding_box(), o.grid_resolution,
+                                                 o.frequency);
+            object = make_shared<HeterogeneousMedium>(object, grid, o.density, o.albedo);
+        }
+
+        if (o.light) {
+            check(group == 0, "lights must be in group 0");
+            lights.add(object);
+        }
+        groups[group].add(object);
+    }
+
+    // children have higher indices than their parents, so a reverse sweep builds bottom-up
+    for (size_t g = groups.size(); g-- > 0;) {
+        const auto& desc = scene.groups[g];
+        check(g == 0 || (desc.parent >= 0 && static_cast<size_t>(desc.parent) < g),
+              "group parent must precede the group");
+
+        shared_ptr<Hittable> group;
+        if (desc.bvh && !groups[g].objects.empty()) {
+            PhaseScope bvh_build(Phase::bvh_build);
+            TraceScope trace("bvh build", g);
+            group = make_shared<BvhNode>(groups[g]);
+        } else {
+            group = make_shared<HittableList>(groups[g]);
+        }
+
+        if (g == 0) {
+            world = desc.bvh ? HittableList(group) : groups[0];
+            break;
+        }
+
+        if (desc.rotate_y != 0) {
+            group = make_shared<RotateY>(group, desc.rotate_y);
+        }
+        if (desc.translate.length_squared() > 0) {
+            group = make_shared<Translate>(group, desc.translate);
+        }
+        groups[desc.parent].add(group);
+    }
+
+    const auto& c = *scene.camera;
+    cam.aspect_ratio = c.aspect_ratio;
+    cam.image_width = c.image_width;
+    cam.samples_per_pixel = c.samples_per_pixel;
+    cam.max_depth = c.max_depth;
+    cam.background = c.background;
+    cam.vfov = c.vfov;
+    cam.look_from = c.look_from;
+    cam.look_at = c.look_at;
+    cam.v_up = c.v_up;
+    cam.defocus_angle = c.defocus_angle;
+    cam.focus_dist = c.focus_dist;
+    cam.features = scene_features(scene);
+}
+
+#endif  // SCENE_H
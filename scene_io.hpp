@@ -0,0 +1,428 @@
+#ifndef SCENE_IO_H
+#define SCENE_IO_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "scene.hpp"
+
+// Scene files come in two forms holding the same tables as SceneDescription.
+//
+// The text form has one record per line; '#' starts a comment. Records are numbered by kind in
+// the order they appear and refer to each other by those numbers:
+//
+//   camera <aspect> <width> <spp> <max_depth> <background rgb> <vfov> <look_from xyz>
+//          <look_at xyz> <v_up xyz> <defocus_angle> <focus_dist>
+//   texture solid <rgb> | checker <scale> <even rgb> <odd rgb> | image <file>
+//           | noise <scale> [bake <resolution> <min xyz> <max xyz>]
+//   material lambertian <texture> | metal <rgb> <fuzz> | dielectric <ior> | light <texture>
+//            | isotropic <texture>
+//   group <parent> <bvh 0|1> <rotate_y degrees> <translate xyz>    (the first group is the world)
+//   sphere <group> <material> <center xyz> <radius> [options]
+//   moving_sphere <group> <material> <center xyz> <center2 xyz> <radius> [options]
+//   quad <group> <material> <q xyz> <u xyz> <v xyz> [options]
+//   box <group> <material> <a xyz> <b xyz> [options]
+//
+// with options 'light', 'constant_medium <density> <albedo rgb>' and
+// 'cloud_medium <density_scale> <albedo rgb> <resolution> <frequency>'.
+//
+// The binary form is a SceneFileHeader followed by the texture, material, group and object
+// records and the string table, each stored as the raw array. MappedScene maps such a file and
+// points a SceneView straight at it, so loading costs one mmap regardless of the object count.
+// Files are only portable between builds with the same record layout and byte order.
+
+class SceneFileHeader {
+public:
+    char magic[4];
+    uint32_t version;
+    uint64_t texture_count;
+    uint64_t material_count;
+    uint64_t group_count;
+    uint64_t object_count;
+    uint64_t string_bytes;
+    CameraDesc camera;
+
+    static constexpr char expected_magic[4] = {'R', 'T', 'W', 'S'};
+    static constexpr uint32_t current_version = 2;
+};
+
+static_assert(sizeof(SceneFileHeader) % 8 == 0 && sizeof(TextureDesc) % 8 == 0 &&
+              sizeof(MaterialDesc) % 8 == 0 && sizeof(GroupDesc) % 8 == 0 &&
+              sizeof(ObjectDesc) % 8 == 0);
+
+inline void write_scene_binary(const SceneView& scene, const std::string& path) {
+    validate_scene(scene);
+    SceneFileHeader header{};
+    std::memcpy(header.magic, SceneFileHeader::expected_magic, sizeof(header.magic));
+    header.version = SceneFileHeader::current_version;
+    header.texture_count = scene.textures.size();
+    header.material_count = scene.materials.size();
+    header.group_count = scene.groups.size();
+    header.object_count = scene.objects.size();
+    header.string_bytes = scene.strings.size();
+    header.camera = *scene.camera;
+
+    std::ofstream out(path, std::ios::binary);
+    auto write = [&](const void* data, size_t bytes) {
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    };
+
+    write(&header, sizeof(header));
+    write(scene.textures.data(), scene.textures.size_bytes());
+    write(scene.materials.data(), scene.materials.size_bytes());
+    write(scene.groups.data(), scene.groups.size_bytes());
+    write(scene.objects.data(), scene.objects.size_bytes());
+    write(scene.strings.data(), scene.strings.size_bytes());
+
+    if (!out) {
+        throw std::runtime_error("could not write scene file '" + path + "'");
+    }
+}
+
+// A binary scene file mapped read-only into memory for the lifetime of the object.
+class MappedScene {
+public:
+    explicit MappedScene(const std::string& path) {
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("could not open scene file '" + path + "'");
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = static_cast<size_t>(st.st_size);
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (data == MAP_FAILED || data == nullptr) {
+            data = nullptr;
+            throw std::runtime_error("could not map scene file '" + path + "'");
+        }
+
+        try {
+            bind(path);
+        } catch (...) {
+            munmap(data, size);
+            throw;
+        }
+    }
+
+    ~MappedScene() {
+        if (data) {
+            munmap(data, size);
+        }
+    }
+
+    MappedScene(const MappedScene&) = delete;
+    MappedScene& operator=(const MappedScene&) = delete;
+
+    const SceneView& view() const { return scene; }
+
+    // True if 'path' starts with the binary scene magic.
+    static bool is_binary(const std::string& path) {
+        char magic[4] = {};
+        std::ifstream in(path, std::ios::binary);
+        in.read(magic, sizeof(magic));
+        return in && std::memcmp(magic, SceneFileHeader::expected_magic, sizeof(magic)) == 0;
+    }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    SceneView scene;
+
+    void bind(const std::string& path) {
+        auto fail = [&](const char* what) {
+            throw std::runtime_error("scene file '" + path + "': " + what);
+        };
+
+        if (size < sizeof(SceneFileHeader)) {
+            fail("truncated header");
+        }
+
+        auto base = static_cast<const char*>(data);
+        auto header = reinterpret_cast<const SceneFileHeader*>(base);
+        if (std::memcmp(header->magic, SceneFileHeader::expected_magic, 4) != 0) {
+            fail("not a binary scene");
+        }
+        if (header->version != SceneFileHeader::current_version) {
+            fail("unsupported version");
+        }
+
+        size_t offset = sizeof(SceneFileHeader);
+        auto table = [&]<typename T>(uint64_t count, std::span<const T>& span) {
+            if (count > (size - offset) / sizeof(T)) {
+                fail("truncated tables");
+            }
+            span = std::span<const T>(reinterpret_cast<const T*>(base + offset), count);
+            offset += count * sizeof(T);
+        };
+
+        scene.camera = &header->camera;
+        table(header->texture_count, scene.textures);
+        table(header->material_count, scene.materials);
+        table(header->group_count, scene.groups);
+        table(header->object_count, scene.objects);
+        table(header->string_bytes, scene.strings);
+
+        if (!scene.strings.empty() && scene.strings.back() != '\0') {
+            fail("unterminated string table");
+        }
+    }
+};
+
+inline void write_scene_text(const SceneView& scene, std::ostream& out) {
+    static const char* texture_names[] = {"solid", "checker", "image", "noise"};
+    static const char* material_names[] = {"lambertian", "metal", "dielectric", "light",
+                                           "isotropic"};
+
+    validate_scene(scene);
+    out.precision(17);
+
+    const auto& c = *scene.camera;
+    out << "camera " << c.aspect_ratio << ' ' << c.image_width << ' ' << c.samples_per_pixel << ' '
+        << c.max_depth << ' ' << c.background << ' ' << c.vfov << ' ' << c.look_from << ' '
+        << c.look_at << ' ' << c.v_up << ' ' << c.defocus_angle << ' ' << c.focus_dist << '\n';
+
+    for (const auto& t : scene.textures) {
+        out << "texture " << texture_names[static_cast<int>(t.type)];
+        switch (t.type) {
+            case TextureType::solid:
+                out << ' ' << t.even;
+                break;
+            case TextureType::checker:
+                out << ' ' << t.scale << ' ' << t.even << ' ' << t.odd;
+                break;
+            case TextureType::image:
+                out << ' ' << scene.string(t.name);
+                break;
+            case TextureType::noise:
+                out << ' ' << t.scale;
+                if (t.resolution > 0) {
+                    out << " bake " << t.resolution << ' ' << t.bake_min << ' ' << t.bake_max;
+                }
+                break;
+        }
+        out << '\n';
+    }
+
+    for (const auto& m : scene.materials) {
+        out << "material " << material_names[static_cast<int>(m.type)];
+        switch (m.type) {
+            case MaterialType::metal:
+                out << ' ' << m.color << ' ' << m.param;
+                break;
+            case MaterialType::dielectric:
+                out << ' ' << m.param;
+                break;
+            default:
+                out << ' ' << m.texture;
+        }
+        out << '\n';
+    }
+
+    for (const auto& g : scene.groups) {
+        out << "group " << g.parent << ' ' << g.bvh << ' ' << g.rotate_y << ' ' << g.translate
+            << '\n';
+    }
+
+    for (const auto& o : scene.objects) {
+        switch (o.shape) {
+            case ShapeType::sphere:
+                if ((o.p1 - o.p0).length_squared() == 0) {
+                    out << "sphere " << o.group << ' ' << o.material << ' ' << o.p0;
+                } else {
+                    out << "moving_sphere " << o.group << ' ' << o.material << ' ' << o.p0 << ' '
+                        << o.p1;
+                }
+                out << ' ' << o.radius;
+                break;
+            case ShapeType::quad:
+                out << "quad " << o.group << ' ' << o.material << ' ' << o.p0 << ' ' << o.p1 << ' '
+                    << o.p2;
+                break;
+            case ShapeType::box:
+                out << "box " << o.group << ' ' << o.material << ' ' << o.p0 << ' ' << o.p1;
+                break;
+        }
+
+        if (o.light) {
+            out << " light";
+        }
+        if (o.medium == MediumType::constant) {
+            out << " constant_medium " << o.density << ' ' << o.albedo;
+        } else if (o.medium == MediumType::cloud) {
+            out << " cloud_medium " << o.density << ' ' << o.albedo << ' ' << o.grid_resolution
+                << ' ' << o.frequency;
+        }
+        out << '\n';
+    }
+}
+
+// Parses the text form. Throws std::runtime_error naming the offending line.
+inline SceneDescription read_scene_text(std::istream& in) {
+    SceneDescription scene;
+    scene.groups.clear();
+
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); ++line_number) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos) {
+            line.erase(hash);
+        }
+
+        std::istringstream tokens(line);
+        std::string kind;
+        if (!(tokens >> kind)) {
+            continue;
+        }
+
+        auto fail = [&](const std::string& what) {
+            throw std::runtime_error("scene line " + std::to_string(line_number) + ": " + what);
+        };
+        auto expect = [&]() {
+            if (tokens.fail()) {
+                fail("malformed " + kind);
+            }
+        };
+        auto vec = [&]() {
+            double x, y, z;
+            tokens >> x >> y >> z;
+            return Vector3d(x, y, z);
+        };
+
+        if (kind == "camera") {
+            auto& c = scene.camera;
+            tokens >> c.aspect_ratio >> c.image_width >> c.samples_per_pixel >> c.max_depth;
+            c.background = vec();
+            tokens >> c.vfov;
+            c.look_from = vec();
+            c.look_at = vec();
+            c.v_up = vec();
+            tokens >> c.defocus_angle >> c.focus_dist;
+        } else if (kind == "texture") {
+            std::string type;
+            tokens >> type;
+            if (type == "solid") {
+                scene.solid(vec());
+            } else if (type == "checker") {
+                double scale;
+                tokens >> scale;
+                auto even = vec();
+                scene.checker(scale, even, vec());
+            } else if (type == "image") {
+                std::string filename;
+                tokens >> filename;
+                scene.image(filename);
+            } else if (type == "noise") {
+                double scale;
+                tokens >> scale;
+                expect();
+                std::string option;
+                if (tokens >> option) {
+                    if (option != "bake") {
+                        fail("unknown noise option '" + option + "'");
+                    }
+                    int resolution;
+                    tokens >> resolution;
+                    auto min = vec();
+                    scene.baked_noise(scale, resolution, min, vec());
+                } else {
+                    tokens.clear();
+                    scene.noise(scale);
+                }
+            } else {
+                fail("unknown texture '" + type + "'");
+            }
+        } else if (kind == "material") {
+            std::string type;
+            tokens >> type;
+            MaterialDesc m{};
+            if (type == "lambertian" || type == "light" || type == "isotropic") {
+                m.type = type == "lambertian" ? MaterialType::lambertian
+                         : type == "light"    ? MaterialType::light
+                                              : MaterialType::isotropic;
+                tokens >> m.texture;
+            } else if (type == "metal") {
+                m.type = MaterialType::metal;
+                m.color = vec();
+                tokens >> m.param;
+            } else if (type == "dielectric") {
+                m.type = MaterialType::dielectric;
+                tokens >> m.param;
+            } else {
+                fail("unknown material '" + type + "'");
+            }
+            scene.materials.push_back(m);
+        } else if (kind == "group") {
+            GroupDesc g{};
+            tokens >> g.parent >> g.bvh >> g.rotate_y;
+            g.translate = vec();
+            scene.groups.push_back(g);
+        } else if (kind == "sphere" || kind == "moving_sphere" || kind == "quad" || kind == "box") {
+            int group, material;
+            tokens >> group >> material;
+            auto p0 = vec();
+
+            int object;
+            if (kind == "sphere") {
+                double radius;
+                tokens >> radius;
+                object = scene.sphere(group, material, p0, radius);
+            } else if (kind == "moving_sphere") {
+                auto p1 = vec();
+                double radius;
+                tokens >> radius;
+                object = scene.moving_sphere(group, material, p0, p1, radius);
+            } else if (kind == "quad") {
+                auto p1 = vec();
+                object = scene.quad(group, material, p0, p1, vec());
+            } else {
+                object = scene.box(group, material, p0, vec());
+            }
+
+            expect();
+
+            std::string option;
+            while (tokens >> option) {
+                if (option == "light") {
+                    scene.objects[object].light = 1;
+                } else if (option == "constant_medium") {
+                    double density;
+                    tokens >> density;
+                    scene.constant_medium(object, density, vec());
+                } else if (option == "cloud_medium") {
+                    double density_scale, frequency;
+                    int resolution;
+                    tokens >> density_scale;
+                    auto albedo = vec();
+                    tokens >> resolution >> frequency;
+                    scene.cloud_medium(object, density_scale, albedo, resolution, frequency);
+                } else {
+                    fail("unknown option '" + option + "'");
+                }
+                expect();
+            }
+        } else {
+            fail("unknown record '" + kind + "'");
+        }
+
+        // every other record must be fully present; object options were checked above
+        if (kind == "camera" || kind == "texture" || kind == "material" || kind == "group") {
+            expect();
+        }
+    }
+
+    return scene;
+}
+
+#endif  // SCENE_IO_H
@@ -0,0 +1,385 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "rtweekend.hpp"
+#include "scene.hpp"
+
+// The built-in scenes, expressed as scene descriptions so they can be rendered directly or
+// exported to a scene file. Random placements are drawn when the description is built.
+
+inline void sky_camera(CameraDesc& cam, double vfov = 20) {
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.7, 0.8, 1);
+
+    cam.vfov = vfov;
+    cam.look_from = Point3d(13, 2, 3);
+    cam.look_at = Point3d(0, 0, 0);
+    cam.v_up = Point3d(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+}
+
+inline void cornell_camera(CameraDesc& cam) {
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth = 50;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.look_from = Point3d(278, 278, -800);
+    cam.look_at = Point3d(278, 278, 0);
+    cam.v_up = Vector3d(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+// The five walls of the Cornell box plus its ceiling light, which is registered as a light.
+inline void cornell_walls(SceneDescription& scene, const Point3d& light_q, const Vector3d& light_u,
+                          const Vector3d& light_v, const Color& light_emission) {
+    auto red = scene.lambertian(Color(.65, .05, .05));
+    auto white = scene.lambertian(Color(.73, .73, .73));
+    auto green = scene.lambertian(Color(.12, .45, .15));
+    auto light = scene.light(light_emission);
+
+    scene.quad(0, green, Point3d(555, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555));
+    scene.quad(0, red, Point3d(0, 0, 0), Vector3d(0, 555, 0), Vector3d(0, 0, 555));
+    scene.objects[scene.quad(0, light, light_q, light_u, light_v)].light = 1;
+    scene.quad(0, white, Point3d(0, 0, 0), Vector3d(555, 0, 0), Vector3d(0, 0, 555));
+    scene.quad(0, white, Point3d(555, 555, 555), Vector3d(-555, 0, 0), Vector3d(0, 0, -555));
+    scene.quad(0, white, Point3d(0, 0, 555), Vector3d(555, 0, 0), Vector3d(0, 555, 0));
+}
+
+inline SceneDescription random_spheres() {
+    SceneDescription scene;
+    scene.groups[0].bvh = 1;
+
+    auto checker = scene.checker(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    scene.sphere(0, scene.lambertian(checker), Point3d(0, -1000, 0), 1000);
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            Point3d center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - Point3d(4, 0.2, 0)).length() > 0.9) {
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = Color::random() * Color::random();
+                    auto center2 = center + Vector3d(0, random_double(0, 0.5), 0);
+                    scene.moving_sphere(0, scene.lambertian(albedo), center, center2, 0.2);
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = Color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    scene.sphere(0, scene.metal(albedo, fuzz), center, 0.2);
+                } else {
+                    // glass
+                    scene.sphere(0, scene.dielectric(1.5), center, 0.2);
+                }
+            }
+        }
+    }
+
+    scene.sphere(0, scene.dielectric(1.5), Point3d(0, 1, 0), 1.0);
+    scene.sphere(0, scene.lambertian(Color(0.4, 0.2, 0.1)), Point3d(-4, 1, 0), 1.0);
+    scene.sphere(0, scene.metal(Color(0.7, 0.6, 0.5), 0.0), Point3d(4, 1, 0), 1.0);
+
+    sky_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription two_spheres() {
+    SceneDescription scene;
+
+    auto checker = scene.lambertian(scene.checker(0.8, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    scene.sphere(0, checker, Point3d(0, -10, 0), 10);
+    scene.sphere(0, checker, Point3d(0, 10, 0), 10);
+
+    sky_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription earth() {
+    SceneDescription scene;
+
+    scene.sphere(0, scene.lambertian(scene.image("earthmap.jpg")), Point3d(0, 0, 0), 2);
+
+    sky_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription two_perlin_spheres() {
+    SceneDescription scene;
+
+    auto pertext = scene.lambertian(scene.noise(4));
+    scene.sphere(0, pertext, Point3d(0, -1000, 0), 1000);
+    scene.sphere(0, pertext, Point3d(0, 2, 0), 2);
+
+    sky_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription quads() {
+    SceneDescription scene;
+
+    auto left_red = scene.lambertian(Color(1, 0.2, 0.2));
+    auto back_green = scene.lambertian(Color(0.2, 1, 0.2));
+    auto right_blue = scene.lambertian(Color(0.2, 0.2, 1));
+    auto upper_orange = scene.lambertian(Color(1, 0.5, 0));
+    auto lower_teal = scene.lambertian(Color(0.2, 0.8, 0.8));
+
+    scene.quad(0, left_red, Point3d(-3, -2, 5), Vector3d(0, 0, -4), Vector3d(0, 4, 0));
+    scene.quad(0, back_green, Point3d(-2, -2, 0), Vector3d(4, 0, 0), Vector3d(0, 4, 0));
+    scene.quad(0, right_blue, Point3d(3, -2, 1), Vector3d(0, 0, 4), Vector3d(0, 4, 0));
+    scene.quad(0, upper_orange, Point3d(-2, 3, 1), Vector3d(4, 0, 0), Vector3d(0, 0, 4));
+    scene.quad(0, lower_teal, Point3d(-2, -3, 5), Vector3d(4, 0, 0), Vector3d(0, 0, -4));
+
+    auto& cam = scene.camera;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0.7, 0.8, 1);
+
+    cam.vfov = 80;
+    cam.look_from = Point3d(0, 0, 9);
+    cam.look_at = Point3d(0, 0, 0);
+    cam.v_up = Vector3d(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    return scene;
+}
+
+inline SceneDescription simple_light() {
+    SceneDescription scene;
+
+    auto pertext = scene.lambertian(scene.noise(4));
+    scene.sphere(0, pertext, Point3d(0, -1000, 0), 1000);
+    scene.sphere(0, pertext, Point3d(0, 2, 0), 2);
+
+    auto difflight = scene.light(Color(4, 4, 4));
+    auto light_quad = scene.quad(0, difflight, Point3d(3, 1, -2), Vector3d(2, 0, 0),
+                                 Vector3d(0, 2, 0));
+    scene.objects[light_quad].light = 1;
+
+    auto& cam = scene.camera;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 20;
+    cam.look_from = Point3d(26, 3, 6);
+    cam.look_at = Point3d(0, 2, 0);
+    cam.v_up = Vector3d(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    return scene;
+}
+
+inline SceneDescription cornell_box() {
+    SceneDescription scene;
+    cornell_walls(scene, Point3d(343, 554, 332), Vector3d(-130, 0, 0), Vector3d(0, 0, -105),
+                  Color(15, 15, 15));
+
+    auto white = scene.lambertian(Color(.73, .73, .73));
+    auto box1 = scene.add_group(0, false, 15, Vector3d(265, 0, 295));
+    scene.box(box1, white, Point3d(0, 0, 0), Point3d(165, 330, 165));
+    auto box2 = scene.add_group(0, false, -18, Vector3d(130, 0, 65));
+    scene.box(box2, white, Point3d(0, 0, 0), Point3d(165, 165, 165));
+
+    cornell_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription cornell_smoke() {
+    SceneDescription scene;
+    cornell_walls(scene, Point3d(113, 554, 127), Vector3d(330, 0, 0), Vector3d(0, 0, 305),
+                  Color(7, 7, 7));
+
+    auto white = scene.lambertian(Color(.73, .73, .73));
+    auto box1 = scene.add_group(0, false, 15, Vector3d(265, 0, 295));
+    scene.constant_medium(scene.box(box1, white, Point3d(0, 0, 0), Point3d(165, 330, 165)), 0.01,
+                          Color(0, 0, 0));
+    auto box2 = scene.add_group(0, false, -18, Vector3d(130, 0, 65));
+    scene.constant_medium(scene.box(box2, white, Point3d(0, 0, 0), Point3d(165, 165, 165)), 0.01,
+                          Color(1, 1, 1));
+
+    cornell_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription cornell_cloud() {
+    SceneDescription scene;
+    cornell_walls(scene, Point3d(113, 554, 127), Vector3d(330, 0, 0), Vector3d(0, 0, 305),
+                  Color(7, 7, 7));
+
+    auto white = scene.lambertian(Color(.73, .73, .73));
+    auto cloud = scene.box(0, white, Point3d(80, 60, 80), Point3d(475, 420, 475));
+    scene.cloud_medium(cloud, 0.5, Color(1, 1, 1), 64, 0.012);
+
+    cornell_camera(scene.camera);
+    return scene;
+}
+
+inline SceneDescription final_scene(int image_width, int samples_per_pixel, int max_depth) {
+    SceneDescription scene;
+
+    auto boxes1 = scene.add_group(0, true);
+    auto ground = scene.lambertian(Color(0.48, 0.83, 0.53));
+
+    int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1, 101);
+            auto z1 = z0 + w;
+
+            scene.box(boxes1, ground, Point3d(x0, y0, z0), Point3d(x1, y1, z1));
+        }
+    }
+
+    auto light = scene.light(Color(7, 7, 7));
+    auto light_quad =
+        scene.quad(0, light, Point3d(123, 554, 147), Vector3d(300, 0, 0), Vector3d(0, 0, 265));
+    scene.objects[light_quad].light = 1;
+
+    auto center1 = Point3d(400, 400, 200);
+    auto center2 = center1 + Vector3d(30, 0, 0);
+    scene.moving_sphere(0, scene.lambertian(Color(0.7, 0.3, 0.1)), center1, center2, 50);
+
+    auto glass = scene.dielectric(1.5);
+    scene.sphere(0, glass, Point3d(260, 150, 45), 50);
+    scene.sphere(0, scene.metal(Color(0.8, 0.8, 0.9), 1.0), Point3d(0, 150, 145), 50);
+
+    scene.sphere(0, glass, Point3d(360, 150, 145), 70);
+    scene.constant_medium(scene.sphere(0, glass, Point3d(360, 150, 145), 70), 0.2,
+                          Color(0.2, 0.4, 0.9));
+    scene.constant_medium(scene.sphere(0, glass, Point3d(0, 0, 0), 5000), 0.0001, Color(1, 1, 1));
+
+    scene.sphere(0, scene.lambertian(scene.image("earthmap.jpg")), Point3d(400, 200, 400), 100);
+    scene.sphere(0, scene.lambertian(scene.noise(0.1)), Point3d(220, 280, 300), 80);
+
+    auto boxes2 = scene.add_group(0, true, 15, Vector3d(-100, 270, 395));
+    auto white = scene.lambertian(Color(0.73, 0.73, 0.73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        scene.sphere(boxes2, white, Point3d::random(0, 165), 10);
+    }
+
+    auto& cam = scene.camera;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth = max_depth;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.look_from = Point3d(478, 278, -600);
+    cam.look_at = Point3d(278, 278, 0);
+    cam.v_up = Vector3d(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    return scene;
+}
+
+// A floor with a few objects under a grid of 'count' small, dim ceiling lights. Most of the light
+// at any point comes from the handful of lights overhead, so this measures how well light sampling
+// finds them among the rest.
+inline SceneDescription many_lights(int count) {
+    SceneDescription scene;
+
+    auto white = scene.lambertian(Color(0.7, 0.7, 0.7));
+    auto red = scene.lambertian(Color(0.8, 0.3, 0.2));
+    auto light = scene.light(Color(0.6, 0.55, 0.5));
+
+    // lights have to be in the root group, so it gets the BVH
+    scene.groups[0].bvh = 1;
+    scene.quad(0, white, Point3d(-30, 0, -30), Vector3d(60, 0, 0), Vector3d(0, 0, 60));
+    scene.sphere(0, red, Point3d(-2, 1, 0), 1);
+    scene.sphere(0, red, Point3d(2, 1, 2), 1);
+    scene.box(0, white, Point3d(-0.5, 0, -4), Point3d(0.5, 3, -3));
+
+    auto per_side = std::max(1, static_cast<int>(std::lround(sqrt(count))));
+    auto cell = 40.0 / per_side;
+    auto side = 0.7 * cell;
+    for (int i = 0; i < per_side; ++i) {
+        for (int j = 0; j < per_side; ++j) {
+            auto corner = Point3d(-20 + (i + 0.15) * cell, 4, -20 + (j + 0.15) * cell);
+            auto quad = scene.quad(0, light, corner, Vector3d(side, 0, 0), Vector3d(0, 0, side));
+            scene.objects[quad].light = 1;
+        }
+    }
+
+    auto& cam = scene.camera;
+    cam.aspect_ratio = 1.5;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 10;
+    cam.background = Color(0, 0, 0);
+
+    cam.vfov = 50;
+    cam.look_from = Point3d(0, 2.5, 9);
+    cam.look_at = Point3d(0, 0.5, 0);
+    cam.v_up = Vector3d(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    return scene;
+}
+
+// Looks up a built-in scene by name. Returns false if there is none.
+inline bool builtin_scene(const std::string& name, SceneDescription& scene) {
+    if (name == "random_spheres") {
+        scene = random_spheres();
+    } else if (name == "two_spheres") {
+        scene = two_spheres();
+    } else if (name == "earth") {
+        scene = earth();
+    } else if (name == "two_perlin_spheres") {
+        scene = two_perlin_spheres();
+    } else if (name == "quads") {
+        scene = quads();
+    } else if (name == "simple_light") {
+        scene = simple_light();
+    } else if (name == "cornell_box") {
+        scene = cornell_box();
+    } else if (name == "cornell_smoke") {
+        scene = cornell_smoke();
+    } else if (name == "cornell_cloud") {
+        scene = cornell_cloud();
+    } else if (name == "many_lights") {
+        scene = many_lights(10000);
+    } else if (name == "final_scene") {
+        scene = final_scene(400, 250, 4);
+    } else if (name == "final_scene_hq") {
+        scene = final_scene(800, 10000, 40);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const std::vector<std::string>& builtin_scene_names() {
+    static const std::vector<std::string> names = {
+        "random_spheres", "two_spheres",  "earth",         "two_perlin_spheres",
+        "quads",          "simple_light", "cornell_box",   "cornell_smoke",
+        "cornell_cloud",  "many_lights",  "final_scene",   "final_scene_hq"};
+    return names;
+}
+
+#endif  // SCENES_H
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.hpp"
+#include "onb.hpp"
 #include "vector3d.hpp"
 
 class Sphere : public Hittable {
@@ -23,6 +24,30 @@ public:
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& rec) const override {
+        Point3d center = is_moving ? sphere_center(r.time()) : center1;
+        double root;
+        if (!nearest_root(r, center, ray_t, root)) {
+            return false;
+        }
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        Vector3d outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.uv_per_unit = 1 / (pi * radius);
+        rec.mat = mat;
+
+        return true;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        double root;
+        return nearest_root(r, is_moving ? sphere_center(r.time()) : center1, ray_t, root);
+    }
+
+    // Both roots of the quadratic at once, clipped to ray_t.
+    bool hit_interval(const Ray& r, Interval ray_t, Interval& span) const override {
         Point3d center = is_moving ? sphere_center(r.time()) : center1;
         Vector3d oc = r.origin() - center;
         auto a = r.direction().length_squared();
@@ -35,27 +60,73 @@ public:
         }
         auto sqrtd = sqrt(discriminant);
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (-half_b - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (-half_b + sqrtd) / a;
-            if (!ray_t.surrounds(root)) {
-                return false;
-            }
-        }
+        auto near = (-half_b - sqrtd) / a;
+        auto far = (-half_b + sqrtd) / a;
+        bool near_inside = ray_t.surrounds(near);
+        bool far_inside = ray_t.surrounds(far);
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        Vector3d outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        if (!near_inside && !far_inside) {
+            return false;
+        }
 
+        span = Interval(near_inside ? near : far, far_inside ? far : near);
         return true;
     }
 
     Aabb bounding_box() const override { return bbox; }
 
+    Aabb bounding_box_at(double time) const override {
+        if (!is_moving) {
+            return bbox;
+        }
+        auto rvec = Vector3d(radius, radius, radius);
+        return Aabb(sphere_center(time) - rvec, sphere_center(time) + rvec);
+    }
+
+    // Light sampling picks directions uniformly inside the cone the sphere subtends. Only the
+    // sphere's position at time 0 is used, so moving emitters are sampled where they start.
+    double pdf_value(const Point3d& origin, const Vector3d& direction) const override {
+        auto distance_squared = (center1 - origin).length_squared();
+        if (distance_squared <= radius * radius) {
+            return 0;
+        }
+
+        HitRecord rec;
+        if (!this->hit(Ray(origin, direction, 0), Interval(0.001, infinity), rec)) {
+            return 0;
+        }
+
+        auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+        auto solid_angle = 2 * pi * (1 - cos_theta_max);
+
+        return 1 / solid_angle;
+    }
+
+    Vector3d random(const Point3d& origin, Sampler& sampler) const override {
+        Vector3d direction = center1 - origin;
+        auto distance_squared = direction.length_squared();
+        if (distance_squared <= radius * radius) {
+            return Vector3d(1, 0, 0);
+        }
+
+        Onb uvw;
+        uvw.build_from_w(direction);
+        auto [r1, r2] = sampler.get_2d();
+        return uvw.local(random_to_sphere(radius, distance_squared, r1, r2));
+    }
+
+    // Like light sampling, emission sampling uses the sphere where it is at time 0.
+    double surface_area() const override { return 4 * pi * radius * radius; }
+
+    void sample_surface(const std::array<double, 2>& u, HitRecord& rec) const override {
+        auto outward_normal = sample_unit_vector(u[0], u[1]);
+        rec.p = center1 + radius * outward_normal;
+        rec.normal = outward_normal;
+        rec.front_face = true;
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat = mat;
+    }
+
 private:
     Point3d center1;
     double radius;
@@ -66,6 +137,41 @@ private:
 
     Point3d sphere_center(double time) const { return center1 + time * center_vec; }
 
+    bool nearest_root(const Ray& r, const Point3d& center, Interval ray_t, double& root) const {
+        Vector3d oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius * radius;
+        auto discriminant = half_b * half_b - a * c;
+
+        if (discriminant < 0) {
+            return false;
+        }
+        auto sqrtd = sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        root = (-half_b - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (-half_b + sqrtd) / a;
+            if (!ray_t.surrounds(root)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static Vector3d random_to_sphere(double radius, double distance_squared, double r1,
+                                     double r2) {
+        auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
+
+        auto phi = 2 * pi * r1;
+        auto x = cos(phi) * sqrt(1 - z * z);
+        auto y = sin(phi) * sqrt(1 - z * z);
+
+        return Vector3d(x, y, z);
+    }
+
     static void get_sphere_uv(const Point3d& p, double& u, double& v) {
         auto theta = acos(-p.y());
         auto phi = atan2(-p.z(), p.x()) + pi;
@@ -0,0 +1,267 @@
+// Checks of the sampling math: permutations, stratification and the densities the light
+// samplers report against the directions they actually pick. Each test is run by name, and the
+// program exits non-zero if any check fails.
+//
+//   raytracing_tests <test>
+
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "color.hpp"
+#include "environment.hpp"
+#include "hittable_list.hpp"
+#include "light_bvh.hpp"
+#include "material.hpp"
+#include "quad.hpp"
+#include "rtweekend.hpp"
+#include "sampler.hpp"
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << '\n';
+        ++failures;
+    }
+}
+
+static bool close_to(double a, double b, double relative) {
+    return fabs(a - b) <= relative * std::max(fabs(a), fabs(b));
+}
+
+static void kensler_permutation() {
+    for (uint32_t n : {1u, 2u, 3u, 7u, 16u, 100u, 257u, 1000u}) {
+        for (uint32_t seed : {0u, 1u, 0x2c1b3c6du, 0xdeadbeefu}) {
+            std::vector<int> seen(n, 0);
+            for (uint32_t i = 0; i < n; ++i) {
+                auto p = kensler_permute(i, n, seed);
+                if (p >= 0 && p < static_cast<int>(n)) {
+                    ++seen[p];
+                }
+            }
+            for (uint32_t p = 0; p < n; ++p) {
+                check(seen[p] == 1, "n=" + std::to_string(n) + " seed=" + std::to_string(seed) +
+                                        ": " + std::to_string(p) + " hit " +
+                                        std::to_string(seen[p]) + " times");
+            }
+        }
+    }
+}
+
+// The strata of 'count' samples from 'offset' on: 1D intervals and the nx by ny grid for 2D.
+static void stratified_strata() {
+    for (int count = 1; count <= 40; ++count) {
+        auto nx = static_cast<int>(sqrt(static_cast<double>(count)));
+        auto ny = (count + nx - 1) / nx;
+        for (int offset : {0, 7}) {
+            for (int pixel = 0; pixel < 4; ++pixel) {
+                StratifiedSampler sampler(count);
+                std::vector<int> strata(count, 0), cells(nx * ny, 0);
+                for (int s = 0; s < count; ++s) {
+                    sampler.start(pixel, 3 * pixel, offset + s);
+                    auto u = sampler.get_1d();
+                    auto [x, y] = sampler.get_2d();
+                    ++strata[std::min(static_cast<int>(u * count), count - 1)];
+                    ++cells[std::min(static_cast<int>(y * ny), ny - 1) * nx +
+                            std::min(static_cast<int>(x * nx), nx - 1)];
+                }
+                for (auto n : strata) {
+                    check(n == 1, "stratified 1D, count " + std::to_string(count));
+                }
+                for (auto n : cells) {
+                    check(n <= 1, "stratified 2D, count " + std::to_string(count));
+                }
+            }
+        }
+    }
+}
+
+// 2^m Sobol points form a (0, m, 2)-net: one point in every 2^a by 2^(m-a) cell, for every a.
+static void sobol_strata() {
+    for (int m = 0; m <= 8; ++m) {
+        auto n = 1 << m;
+        for (int pixel = 0; pixel < 4; ++pixel) {
+            for (int dimension = 0; dimension < 4; ++dimension) {
+                SobolSampler sampler;
+                std::vector<double> u(n);
+                std::vector<std::array<double, 2>> points(n);
+                for (int s = 0; s < n; ++s) {
+                    sampler.start(pixel, 5 * pixel, s);
+                    sampler.set_dimension(2 * dimension);
+                    u[s] = sampler.get_1d();
+                    points[s] = sampler.get_2d();
+                }
+
+                std::vector<int> strata(n, 0);
+                for (auto x : u) {
+                    ++strata[std::min(static_cast<int>(x * n), n - 1)];
+                }
+                for (auto count : strata) {
+                    check(count == 1, "sobol 1D, " + std::to_string(n) + " points");
+                }
+
+                for (int a = 0; a <= m; ++a) {
+                    auto nx = 1 << a, ny = n / nx;
+                    std::vector<int> cells(n, 0);
+                    for (auto [x, y] : points) {
+                        ++cells[std::min(static_cast<int>(y * ny), ny - 1) * nx +
+                                std::min(static_cast<int>(x * nx), nx - 1)];
+                    }
+                    for (auto count : cells) {
+                        check(count == 1, "sobol 2D, " + std::to_string(n) + " points in " +
+                                              std::to_string(nx) + "x" + std::to_string(ny));
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void blue_noise_ranks() {
+    const auto& mask = BlueNoiseMask::instance();
+    constexpr int n = BlueNoiseMask::size * BlueNoiseMask::size;
+    std::vector<int> seen(n, 0);
+    for (int y = 0; y < BlueNoiseMask::size; ++y) {
+        for (int x = 0; x < BlueNoiseMask::size; ++x) {
+            auto rank = static_cast<int>(mask.at(x, y) * n);
+            if (rank >= 0 && rank < n) {
+                ++seen[rank];
+            }
+        }
+    }
+    for (int r = 0; r < n; ++r) {
+        check(seen[r] == 1, "blue-noise rank " + std::to_string(r) + " appears " +
+                                std::to_string(seen[r]) + " times");
+    }
+}
+
+// Sample directions and check that, texel by texel, luminance over
+// the reported pdf integrates to the texel's luminance times its solid angle.
+static void environment_inversion() {
+    constexpr int width = 16, height = 8;
+    std::vector<Color> texels;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            texels.push_back(j == 2 ? Color(0, 0, 0) : Color(1 + i, 1 + j, 0.5 * (i ^ j)));
+        }
+    }
+    texels[5 * width + 11] = Color(500, 400, 300);  // a sun
+    EnvironmentMap map(width, height, texels);
+
+    auto texel_of = [](const Vector3d& d) {
+        auto theta = acos(std::clamp(d.y(), -1.0, 1.0));
+        auto phi = atan2(-d.z(), d.x()) + pi;
+        auto i = std::clamp(static_cast<int>(phi / (2 * pi) * width), 0, width - 1);
+        auto j = std::clamp(static_cast<int>(theta / pi * height), 0, height - 1);
+        return j * width + i;
+    };
+
+    // Sobol points put close to the ideal number of samples in every texel's cell of [0, 1)^2
+    constexpr int samples = 1 << 20;
+    std::vector<double> estimate(width * height, 0);
+    SobolSampler points;
+    for (int s = 0; s < samples; ++s) {
+        points.start(0, 0, s);
+        double pdf;
+        auto d = map.sample(points.get_2d(), pdf);
+        check(close_to(pdf, map.pdf(d), 1e-4) || pdf == 0, "sample() and pdf() disagree");
+        if (pdf > 0) {
+            estimate[texel_of(d)] += luminance(map.radiance(d)) / pdf / samples;
+        }
+    }
+
+    for (int j = 0; j < height; ++j) {
+        auto solid_angle = 2 * pi / width * (cos(pi * j / height) - cos(pi * (j + 1) / height));
+        for (int i = 0; i < width; ++i) {
+            auto expected = luminance(texels[j * width + i]) * solid_angle;
+            check(fabs(estimate[j * width + i] - expected) <= 0.005 * expected + 1e-9,
+                  "texel " + std::to_string(i) + "," + std::to_string(j) + ": integral " +
+                      std::to_string(estimate[j * width + i]) + ", expected " +
+                      std::to_string(expected));
+        }
+    }
+}
+
+// Light by light, 1/pdf over the directions random() picks must integrate to the solid angle the
+// light subtends, which uniform directions over the sphere measure independently.
+static void light_bvh_pdf() {
+    srand(1);
+    HittableList lights;
+    auto add = [&](Point3d q, Vector3d u, Vector3d v, double power) {
+        auto emitter = make_shared<DiffuseLight>(Color(power, power, power));
+        lights.add(make_shared<Quad>(q, u, v, emitter));
+    };
+    add(Point3d(-1, 3, -1), Vector3d(2, 0, 0), Vector3d(0, 0, 2), 4);
+    add(Point3d(3, -1, -1), Vector3d(0, 2, 0), Vector3d(0, 0, 1), 1);
+    add(Point3d(-4, -1, 2), Vector3d(1, 0, 1), Vector3d(0, 2, 0), 20);
+    add(Point3d(1, -3, 1), Vector3d(1, 0, 0), Vector3d(0, 0, 1), 0.5);
+    add(Point3d(-2, 1, -5), Vector3d(3, 0, 0), Vector3d(0, 1, 0), 8);
+    add(Point3d(4, 4, 4), Vector3d(2, 0, 0), Vector3d(0, 2, 0), 100);
+    LightBvh tree(lights);
+
+    Point3d origin(0, 0.2, 0.1);
+    auto light_hit = [&](const Vector3d& d) {
+        for (size_t k = 0; k < lights.objects.size(); ++k) {
+            HitRecord rec;
+            if (lights.objects[k]->hit(Ray(origin, d, 0), Interval(0.001, infinity), rec)) {
+                return static_cast<int>(k);
+            }
+        }
+        return -1;
+    };
+
+    constexpr int samples = 400000;
+    std::vector<double> sampled(lights.objects.size(), 0), uniform(lights.objects.size(), 0);
+    IndependentSampler sampler;
+    for (int s = 0; s < samples; ++s) {
+        sampler.start(0, 0, s);
+        auto d = tree.random(origin, sampler);
+        auto pdf = tree.pdf_value(origin, d);
+        auto k = light_hit(d);
+        check(pdf > 0 && k >= 0, "random() picked a direction pdf_value() gives no density");
+        if (pdf > 0 && k >= 0) {
+            sampled[k] += 1 / pdf / samples;
+        }
+    }
+    constexpr int directions = 4000000;
+    for (int s = 0; s < directions; ++s) {
+        if (auto k = light_hit(random_unit_vector()); k >= 0) {
+            uniform[k] += 4 * pi / directions;
+        }
+    }
+
+    for (size_t k = 0; k < lights.objects.size(); ++k) {
+        check(close_to(sampled[k], uniform[k], 0.05),
+              "light " + std::to_string(k) + ": sampled solid angle " +
+                  std::to_string(sampled[k]) + ", measured " + std::to_string(uniform[k]));
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::map<std::string, std::function<void()>> tests = {
+        {"kensler_permutation", kensler_permutation},
+        {"stratified_strata", stratified_strata},
+        {"sobol_strata", sobol_strata},
+        {"blue_noise_ranks", blue_noise_ranks},
+        {"environment_inversion", environment_inversion},
+        {"light_bvh_pdf", light_bvh_pdf},
+    };
+
+    auto test = argc == 2 ? tests.find(argv[1]) : tests.end();
+    if (test == tests.end()) {
+        std::cerr << "usage: raytracing_tests <test>\n  tests:";
+        for (const auto& [name, run] : tests) {
+            std::cerr << ' ' << name;
+        }
+        std::cerr << '\n';
+        return 1;
+    }
+
+    test->second();
+    return failures == 0 ? 0 : 1;
+}
@@ -3,14 +3,21 @@
 
 #include "color.hpp"
 #include "perlin.hpp"
-#include "rtw_stb_image.hpp"
 #include "rtweekend.hpp"
+#include "texture_cache.hpp"
+#include "volume.hpp"
 
 class Texture {
 public:
     virtual ~Texture() = default;
 
     virtual Color value(double u, double v, const Point3d& p) const = 0;
+
+    // Lookup filtered over a footprint of the given width in texture space. Textures that do
+    // not prefilter ignore the footprint.
+    virtual Color filtered_value(double u, double v, const Point3d& p, double footprint) const {
+        return value(u, v, p);
+    }
 };
 
 class SolidColor : public Texture {
@@ -45,6 +52,17 @@ public:
         return is_even ? even->value(u, v, p) : odd->value(u, v, p);
     }
 
+    Color filtered_value(double u, double v, const Point3d& p, double footprint) const override {
+        auto x_int = static_cast<int>(std::floor(inv_scale * p.x()));
+        auto y_int = static_cast<int>(std::floor(inv_scale * p.y()));
+        auto z_int = static_cast<int>(std::floor(inv_scale * p.z()));
+
+        bool is_even = (x_int + y_int + z_int) % 2 == 0;
+
+        return is_even ? even->filtered_value(u, v, p, footprint)
+                       : odd->filtered_value(u, v, p, footprint);
+    }
+
 private:
     double inv_scale;
     std::shared_ptr<Texture> even;
@@ -53,27 +71,25 @@ private:
 
 class ImageTexture : public Texture {
 public:
-    ImageTexture(const char* filename) : image(filename) {}
+    ImageTexture(const char* filename) : image(TextureCache::instance().load(filename)) {}
 
     Color value(double u, double v, const Point3d& p) const override {
-        if (image.height() <= 0) {
+        return filtered_value(u, v, p, 0);
+    }
+
+    Color filtered_value(double u, double v, const Point3d& p, double footprint) const override {
+        if (!image) {
             return Color(0, 1, 1);
         }
 
         u = Interval(0, 1).clamp(u);
         v = 1.0 - Interval(0, 1).clamp(v);
 
-        auto i = static_cast<int>(u * image.width());
-        auto j = static_cast<int>(v * image.height());
-        auto pixel = image.pixel_data(i, j);
-
-        auto color_scale = 1.0 / 255.0;
-
-        return Color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+        return image->trilinear(u, v, footprint);
     }
 
 private:
-    RtwImage image;
+    shared_ptr<CachedImage> image;
 };
 
 class NoiseTexture : public Texture {
@@ -82,14 +98,68 @@ public:
 
     NoiseTexture(double sc) : scale(sc) {}
 
+    // Bake mode for static scenes: the turbulence over 'bounds' is precomputed into a grid of
+    // resolution^3 samples and looked up trilinearly. Points outside the bounds are evaluated
+    // exactly. bake_error() tells how far the interpolation strays from the exact noise.
+    NoiseTexture(double sc, const Aabb& bounds, int resolution) : scale(sc) {
+        bake(bounds, resolution);
+    }
+
+    // Turbulence error of the baked grid, measured at random points in its bounds; zero if the
+    // noise is not baked.
+    struct BakeError {
+        double max = 0;
+        double rms = 0;
+    };
+
+    const BakeError& bake_error() const { return error; }
+
     Color value(double u, double v, const Point3d& p) const override {
         auto s = scale * p;
-        return Color(1, 1, 1) * 0.5 * (1 + sin(s.z() + 10 * noise.turb(s)));
+        return Color(1, 1, 1) * 0.5 * (1 + sin(s.z() + 10 * turb(p)));
     }
 
 private:
     Perlin noise;
     double scale;
+    shared_ptr<DensityGrid> baked;
+    BakeError error;
+
+    double turb(const Point3d& p) const {
+        if (baked) {
+            const auto& b = baked->bounding_box();
+            if (b.x.contains(p.x()) && b.y.contains(p.y()) && b.z.contains(p.z())) {
+                return baked->density(p);
+            }
+        }
+        return noise.turb(scale * p);
+    }
+
+    void bake(const Aabb& bounds, int resolution) {
+        auto grid = make_shared<DensityGrid>(bounds, resolution, resolution, resolution);
+        for (int k = 0; k < resolution; ++k) {
+            for (int j = 0; j < resolution; ++j) {
+                for (int i = 0; i < resolution; ++i) {
+                    grid->at(i, j, k) = noise.turb(scale * grid->sample_position(i, j, k));
+                }
+            }
+        }
+
+        const int probes = 4096;
+        auto max_error = 0.0, sum_squared = 0.0;
+        for (int n = 0; n < probes; ++n) {
+            Point3d p(random_double(bounds.x.min, bounds.x.max),
+                      random_double(bounds.y.min, bounds.y.max),
+                      random_double(bounds.z.min, bounds.z.max));
+            auto error = fabs(grid->density(p) - noise.turb(scale * p));
+            max_error = fmax(max_error, error);
+            sum_squared += error * error;
+        }
+
+        error.max = max_error;
+        error.rms = sqrt(sum_squared / probes);
+        baked = grid;
+    }
 };
 
 #endif  // TEXTURE_H
\ No newline at end of file
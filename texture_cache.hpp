@@ -0,0 +1,428 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "color.hpp"
+#include "rtw_stb_image.hpp"
+#include "rtweekend.hpp"
+
+class TextureCache;
+
+// An image served by the TextureCache: a mip pyramid of float RGB texels (scaled to [0,1] exactly
+// as the 8-bit data was interpreted before, built with a 2x2 box filter) stored in 16x16 texel
+// tiles. Nothing is decoded until a lookup needs it: the first miss decodes the source file,
+// level 0 tiles are converted from it, and coarser tiles are filtered from the four finer tiles
+// below them. Any tile, and the decoded source itself, may later be evicted by the cache and is
+// rebuilt on the next miss.
+class CachedImage {
+public:
+    CachedImage(TextureCache& cache, const std::string& path, int width, int height)
+        : cache(cache), path(path) {
+        levels.push_back(Level(width, height));
+        while (levels.back().width > 1 || levels.back().height > 1) {
+            const auto& fine = levels.back();
+            levels.push_back(Level(std::max(1, fine.width / 2), std::max(1, fine.height / 2)));
+        }
+    }
+
+    int width() const { return levels[0].width; }
+    int height() const { return levels[0].height; }
+    int level_count() const { return static_cast<int>(levels.size()); }
+
+    // Trilinear lookup at image coordinates u, v in [0,1] (v = 0 is the top row) for a footprint
+    // of the given width in the same units. A zero footprint is a bilinear lookup of level 0.
+    Color trilinear(double u, double v, double footprint) const;
+
+private:
+    friend class TextureCache;
+
+    static constexpr int tile_size = 16;
+    static constexpr size_t tile_bytes = 3 * tile_size * tile_size * sizeof(float);
+
+    struct Tile {
+        std::unique_ptr<float[]> texels;
+        std::atomic<uint64_t> last_used{0};
+    };
+
+    struct Level {
+        int width, height, tiles_x, tiles_y;
+        std::unique_ptr<Tile[]> tiles;
+
+        Level(int w, int h)
+            : width(w),
+              height(h),
+              tiles_x((w + tile_size - 1) / tile_size),
+              tiles_y((h + tile_size - 1) / tile_size),
+              tiles(new Tile[tiles_x * tiles_y]) {}
+
+        Tile& tile_at(int x, int y) const {
+            return tiles[(y / tile_size) * tiles_x + (x / tile_size)];
+        }
+
+        const float* texel(int x, int y) const {
+            auto within = (y % tile_size) * tile_size + (x % tile_size);
+            return &tile_at(x, y).texels[3 * within];
+        }
+    };
+
+    TextureCache& cache;
+    std::string path;
+    std::vector<Level> levels;
+    std::unique_ptr<RtwImage> source;
+    std::atomic<uint64_t> source_last_used{0};
+
+    // Readers hold it shared for a whole lookup; misses and evictions hold it exclusively.
+    mutable std::shared_mutex mutex;
+
+    struct Footprint {
+        int level, x0, y0;
+        double fx, fy;
+    };
+
+    Footprint footprint_at(int level, double u, double v) const {
+        const auto& l = levels[level];
+        auto x = u * l.width - 0.5;
+        auto y = v * l.height - 0.5;
+        auto x0 = static_cast<int>(floor(x));
+        auto y0 = static_cast<int>(floor(y));
+        return Footprint{level, x0, y0, x - x0, y - y0};
+    }
+
+    bool resident(const Footprint& f) const {
+        const auto& l = levels[f.level];
+        for (int dy = 0; dy < 2; ++dy) {
+            for (int dx = 0; dx < 2; ++dx) {
+                auto& tile = l.tile_at(std::clamp(f.x0 + dx, 0, l.width - 1),
+                                       std::clamp(f.y0 + dy, 0, l.height - 1));
+                if (!tile.texels) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void make_resident(const Footprint& f) {
+        const auto& l = levels[f.level];
+        for (int dy = 0; dy < 2; ++dy) {
+            for (int dx = 0; dx < 2; ++dx) {
+                make_resident(f.level, std::clamp(f.x0 + dx, 0, l.width - 1) / tile_size,
+                              std::clamp(f.y0 + dy, 0, l.height - 1) / tile_size);
+            }
+        }
+    }
+
+    void make_resident(int level, int tx, int ty);
+
+    Color texel(int level, int x, int y) const;
+
+    Color bilinear(const Footprint& f) const {
+        auto x0 = f.x0, y0 = f.y0, l = f.level;
+        auto fx = f.fx, fy = f.fy;
+        return (1 - fy) * ((1 - fx) * texel(l, x0, y0) + fx * texel(l, x0 + 1, y0)) +
+               fy * ((1 - fx) * texel(l, x0, y0 + 1) + fx * texel(l, x0 + 1, y0 + 1));
+    }
+};
+
+// Process-wide cache of image textures. Images are deduplicated by resolved path and by content
+// hash, decoded lazily, and their tiles are evicted least-recently-used first whenever the
+// resident texel data exceeds the memory budget (RTW_TEXTURE_BUDGET_MB, default 1024).
+class TextureCache {
+public:
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // Returns the image for 'filename', or nullptr if it cannot be found or read. Only the file
+    // header is parsed here; pixel data is decoded on first use.
+    shared_ptr<CachedImage> load(const char* filename) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+
+        auto named = by_name.find(filename);
+        if (named != by_name.end()) {
+            return named->second;
+        }
+
+        shared_ptr<CachedImage> image;
+        auto path = RtwImage::find(filename);
+
+        if (!path.empty()) {
+            auto resolved = by_path.find(path);
+            if (resolved != by_path.end()) {
+                image = resolved->second;
+            } else {
+                image = open(path);
+                by_path[path] = image;
+            }
+        }
+
+        if (!image) {
+            std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+        }
+
+        by_name[filename] = image;
+        return image;
+    }
+
+    void set_memory_budget(size_t bytes) {
+        budget = bytes;
+        enforce_budget();
+    }
+
+    size_t memory_budget() const { return budget; }
+    size_t memory_used() const { return used; }
+    size_t evictions() const { return evicted; }
+
+private:
+    friend class CachedImage;
+
+    // Tiles touched within this many loads of the present are never evicted, so a lookup can
+    // always complete even under a budget smaller than its working set.
+    static constexpr uint64_t protected_window = 64;
+
+    std::mutex registry_mutex;
+    std::unordered_map<std::string, shared_ptr<CachedImage>> by_name;
+    std::unordered_map<std::string, shared_ptr<CachedImage>> by_path;
+    std::unordered_map<uint64_t, shared_ptr<CachedImage>> by_hash;
+    std::vector<shared_ptr<CachedImage>> images;
+
+    std::mutex eviction_mutex;
+    std::atomic<size_t> budget;
+    std::atomic<size_t> used{0};
+    std::atomic<size_t> evicted{0};
+    std::atomic<uint64_t> clock{1};
+
+    TextureCache() {
+        auto megabytes = getenv("RTW_TEXTURE_BUDGET_MB");
+        budget = (megabytes ? std::strtoull(megabytes, nullptr, 10) : 1024) << 20;
+    }
+
+    shared_ptr<CachedImage> open(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return nullptr;
+        }
+
+        // FNV-1a over the file contents catches the same image reached through different paths
+        uint64_t hash = 14695981039346656037ull;
+        for (auto it = std::istreambuf_iterator<char>(file); it != std::istreambuf_iterator<char>();
+             ++it) {
+            hash = (hash ^ static_cast<unsigned char>(*it)) * 1099511628211ull;
+        }
+
+        auto same = by_hash.find(hash);
+        if (same != by_hash.end()) {
+            return same->second;
+        }
+
+        int width, height, channels;
+        if (!stbi_info(path.c_str(), &width, &height, &channels) || width <= 0 || height <= 0) {
+            return nullptr;
+        }
+
+        auto image = make_shared<CachedImage>(*this, path, width, height);
+        by_hash[hash] = image;
+        images.push_back(image);
+        return image;
+    }
+
+    uint64_t now() const { return clock.load(std::memory_order_relaxed); }
+
+    // Stamps an entry as used. Stamps only change when the clock has moved on, which keeps
+    // cache lines of hot tiles from bouncing between render threads.
+    static void touch(std::atomic<uint64_t>& stamp, uint64_t time) {
+        if (stamp.load(std::memory_order_relaxed) != time) {
+            stamp.store(time, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t charge(size_t bytes) {
+        used += bytes;
+        return ++clock;
+    }
+
+    void enforce_budget() {
+        if (used <= budget) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(eviction_mutex);
+        if (used <= budget) {
+            return;
+        }
+
+        struct Candidate {
+            uint64_t stamp;
+            CachedImage* image;
+            int level;  // -1 for the decoded source
+            int index;
+        };
+
+        std::vector<Candidate> candidates;
+        std::vector<shared_ptr<CachedImage>> snapshot;
+        {
+            std::lock_guard<std::mutex> registry_lock(registry_mutex);
+            snapshot = images;
+        }
+
+        for (const auto& image : snapshot) {
+            std::shared_lock<std::shared_mutex> image_lock(image->mutex);
+            if (image->source) {
+                candidates.push_back({image->source_last_used.load(), image.get(), -1, 0});
+            }
+            for (int level = 0; level < image->level_count(); ++level) {
+                const auto& l = image->levels[level];
+                for (int i = 0; i < l.tiles_x * l.tiles_y; ++i) {
+                    if (l.tiles[i].texels) {
+                        candidates.push_back({l.tiles[i].last_used.load(), image.get(), level, i});
+                    }
+                }
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.stamp < b.stamp; });
+
+        // evict down to 90% of the budget so that steady misses do not rescan on every load
+        auto target = budget - budget / 10;
+        auto horizon = now() > protected_window ? now() - protected_window : 0;
+
+        for (const auto& c : candidates) {
+            if (used <= target || c.stamp >= horizon) {
+                break;
+            }
+
+            std::unique_lock<std::shared_mutex> image_lock(c.image->mutex);
+            if (c.level < 0) {
+                if (c.image->source) {
+                    used -= static_cast<size_t>(c.image->width()) * c.image->height() * 3;
+                    c.image->source.reset();
+                    ++evicted;
+                }
+            } else {
+                auto& tile = c.image->levels[c.level].tiles[c.index];
+                if (tile.texels) {
+                    tile.texels.reset();
+                    used -= CachedImage::tile_bytes;
+                    ++evicted;
+                }
+            }
+        }
+    }
+};
+
+inline Color CachedImage::trilinear(double u, double v, double footprint) const {
+    auto texels = footprint * std::max(width(), height());
+    auto lod = texels <= 1 ? 0.0 : fmin(log2(texels), level_count() - 1.0);
+    auto level = std::min(static_cast<int>(lod), level_count() - 1);
+    auto blend = level < level_count() - 1 ? lod - level : 0.0;
+
+    auto fine = footprint_at(level, u, v);
+    auto coarse = footprint_at(std::min(level + 1, level_count() - 1), u, v);
+
+    auto filter = [&]() {
+        auto result = bilinear(fine);
+        return blend > 0 ? (1 - blend) * result + blend * bilinear(coarse) : result;
+    };
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (resident(fine) && (blend <= 0 || resident(coarse))) {
+            return filter();
+        }
+    }
+
+    Color result;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto self = const_cast<CachedImage*>(this);
+        self->make_resident(fine);
+        if (blend > 0) {
+            self->make_resident(coarse);
+        }
+        result = filter();
+    }
+
+    cache.enforce_budget();
+    return result;
+}
+
+inline void CachedImage::make_resident(int level, int tx, int ty) {
+    auto& l = levels[level];
+    auto& tile = l.tiles[ty * l.tiles_x + tx];
+    if (tile.texels) {
+        return;
+    }
+
+    auto texels = std::make_unique<float[]>(3 * tile_size * tile_size);
+    auto x_end = std::min(l.width, (tx + 1) * tile_size);
+    auto y_end = std::min(l.height, (ty + 1) * tile_size);
+
+    if (level == 0) {
+        if (!source) {
+            source = std::make_unique<RtwImage>();
+            source->load(path);
+            source_last_used = cache.charge(static_cast<size_t>(width()) * height() * 3);
+        }
+        TextureCache::touch(source_last_used, cache.now());
+
+        auto color_scale = 1.0f / 255.0f;
+        for (int y = ty * tile_size; y < y_end; ++y) {
+            for (int x = tx * tile_size; x < x_end; ++x) {
+                auto pixel = source->pixel_data(x, y);
+                auto texel = &texels[3 * ((y % tile_size) * tile_size + (x % tile_size))];
+                for (int c = 0; c < 3; ++c) {
+                    texel[c] = color_scale * pixel[c];
+                }
+            }
+        }
+    } else {
+        const auto& fine = levels[level - 1];
+        for (int fy = 2 * ty; fy < std::min(2 * ty + 2, fine.tiles_y); ++fy) {
+            for (int fx = 2 * tx; fx < std::min(2 * tx + 2, fine.tiles_x); ++fx) {
+                make_resident(level - 1, fx, fy);
+            }
+        }
+
+        for (int y = ty * tile_size; y < y_end; ++y) {
+            for (int x = tx * tile_size; x < x_end; ++x) {
+                auto x0 = std::min(2 * x, fine.width - 1);
+                auto x1 = std::min(2 * x + 1, fine.width - 1);
+                auto y0 = std::min(2 * y, fine.height - 1);
+                auto y1 = std::min(2 * y + 1, fine.height - 1);
+                auto texel = &texels[3 * ((y % tile_size) * tile_size + (x % tile_size))];
+                for (int c = 0; c < 3; ++c) {
+                    texel[c] = 0.25f * (fine.texel(x0, y0)[c] + fine.texel(x1, y0)[c] +
+                                        fine.texel(x0, y1)[c] + fine.texel(x1, y1)[c]);
+                }
+            }
+        }
+    }
+
+    tile.texels = std::move(texels);
+    tile.last_used = cache.charge(tile_bytes);
+}
+
+inline Color CachedImage::texel(int level, int x, int y) const {
+    const auto& l = levels[level];
+    x = std::clamp(x, 0, l.width - 1);
+    y = std::clamp(y, 0, l.height - 1);
+
+    TextureCache::touch(l.tile_at(x, y).last_used, cache.now());
+    auto t = l.texel(x, y);
+    return Color(t[0], t[1], t[2]);
+}
+
+#endif  // TEXTURE_CACHE_H
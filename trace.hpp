@@ -0,0 +1,158 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Timeline recording in the Chrome trace event format, viewable in Perfetto or about:tracing.
+// Every thread appends complete events to its own buffer, so recording takes no locks; buffers
+// are published once through a lock-free list and outlive their threads so write() can collect
+// them after the render. Until enable() is called, TraceScope costs a single predictable branch.
+
+class Tracer {
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // Must be called before the threads to be traced start.
+    void enable() { active = true; }
+
+    static bool enabled() { return active; }
+
+    // Names the calling thread in the trace.
+    static void name_thread(const std::string& name) {
+        if (active) {
+            local().name = name;
+        }
+    }
+
+    // Records an event that started at 'begin' (from now()) and ends now. 'name' must outlive the
+    // tracer; 'arg', when not negative, is shown as the event's 'index' argument.
+    static void record(const char* name, int64_t begin, int64_t arg = -1) {
+        local().events.push_back({name, begin, now() - begin, arg});
+    }
+
+    // Nanoseconds since the tracer was created.
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - instance().epoch)
+            .count();
+    }
+
+    // Writes every event recorded so far. Call it once the traced threads have finished.
+    void write(std::ostream& out) const {
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        auto first = true;
+        auto separate = [&]() {
+            out << (first ? "" : ",\n");
+            first = false;
+        };
+
+        for (auto buffer = head.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            separate();
+            out << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << buffer->id
+                << ", \"args\": {\"name\": \"" << escape(buffer->name) << "\"}}";
+
+            for (const auto& e : buffer->events) {
+                separate();
+                out << "{\"ph\": \"X\", \"name\": \"" << escape(e.name)
+                    << "\", \"pid\": 1, \"tid\": " << buffer->id << ", \"ts\": " << e.begin / 1000.0
+                    << ", \"dur\": " << e.duration / 1000.0;
+                if (e.arg >= 0) {
+                    out << ", \"args\": {\"index\": " << e.arg << "}";
+                }
+                out << "}";
+            }
+        }
+
+        out << "\n]}\n";
+    }
+
+private:
+    struct Event {
+        const char* name;
+        int64_t begin;
+        int64_t duration;
+        int64_t arg;
+    };
+
+    struct ThreadBuffer {
+        int id;
+        std::string name;
+        std::vector<Event> events;
+        ThreadBuffer* next;
+    };
+
+    static inline bool active = false;
+
+    // 'text' as the contents of a JSON string.
+    static std::string escape(std::string_view text) {
+        std::string escaped;
+        for (auto c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                static const char hex[] = "0123456789abcdef";
+                escaped += "\\u00";
+                escaped += hex[(c >> 4) & 0xf];
+                escaped += hex[c & 0xf];
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::atomic<ThreadBuffer*> head{nullptr};
+    std::atomic<int> thread_count{0};
+
+    // Buffers are intentionally never freed: they must survive their threads until write().
+    static ThreadBuffer& local() {
+        thread_local ThreadBuffer* buffer = instance().attach();
+        return *buffer;
+    }
+
+    ThreadBuffer* attach() {
+        auto id = ++thread_count;
+        auto buffer = new ThreadBuffer{id, "thread " + std::to_string(id), {}, nullptr};
+        buffer->events.reserve(256);
+
+        buffer->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(buffer->next, buffer, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+        }
+        return buffer;
+    }
+};
+
+// Records the enclosing block as one event on the calling thread's timeline.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, int64_t arg = -1)
+        : name(name), arg(arg), begin(Tracer::enabled() ? Tracer::now() : 0) {}
+
+    ~TraceScope() {
+        if (Tracer::enabled()) {
+            Tracer::record(name, begin, arg);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    int64_t arg;
+    int64_t begin;
+};
+
+#endif  // TRACE_H
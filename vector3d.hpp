@@ -112,7 +112,39 @@ inline Vector3d random_in_unit_sphere() {
     }
 }
 
-inline Vector3d random_unit_vector() { return unit_vector(random_in_unit_sphere()); }
+// Point in the unit disk from two uniform values (polar mapping, area preserving).
+inline Vector3d sample_unit_disk(double u1, double u2) {
+    auto r = sqrt(u1);
+    auto phi = 2 * pi * u2;
+    return Vector3d(r * cos(phi), r * sin(phi), 0);
+}
+
+// Uniform direction on the unit sphere from two uniform values.
+inline Vector3d sample_unit_vector(double u1, double u2) {
+    auto z = 1 - 2 * u1;
+    auto r = sqrt(fmax(0.0, 1 - z * z));
+    auto phi = 2 * pi * u2;
+    return Vector3d(r * cos(phi), r * sin(phi), z);
+}
+
+// Uniform direction on the unit sphere, drawn directly rather than by rejection.
+inline Vector3d random_unit_vector() {
+    return sample_unit_vector(random_double(), random_double());
+}
+
+// Cosine-weighted direction about +z, with density cos(theta) / pi, from two uniform values.
+inline Vector3d sample_cosine_direction(double r1, double r2) {
+    auto phi = 2 * pi * r1;
+    auto x = cos(phi) * sqrt(r2);
+    auto y = sin(phi) * sqrt(r2);
+    auto z = sqrt(1 - r2);
+
+    return Vector3d(x, y, z);
+}
+
+inline Vector3d random_cosine_direction() {
+    return sample_cosine_direction(random_double(), random_double());
+}
 
 inline Vector3d random_in_hemisphere(const Vector3d& normal) {
     Vector3d on_unit_sphere = random_unit_vector();
@@ -0,0 +1,216 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <algorithm>
+#include <vector>
+
+#include "aabb.hpp"
+#include "perlin.hpp"
+#include "rtweekend.hpp"
+
+// Dense grid of density samples spanning a box. Samples sit on the grid corners, so a grid of
+// resolution n has n samples along each axis, and lookups interpolate trilinearly. Points outside
+// the box have zero density.
+class DensityGrid {
+public:
+    DensityGrid(const Aabb& bounds, int nx, int ny, int nz)
+        : bounds(bounds), nx(nx), ny(ny), nz(nz), values(nx * ny * nz, 0.0f) {}
+
+    // A cloud-like field of Perlin turbulence that fades out towards the faces of the box.
+    static shared_ptr<DensityGrid> noise_cloud(const Aabb& bounds, int resolution,
+                                               double frequency, double threshold = 0.2) {
+        auto grid = make_shared<DensityGrid>(bounds, resolution, resolution, resolution);
+        Perlin noise;
+
+        for (int k = 0; k < resolution; ++k) {
+            for (int j = 0; j < resolution; ++j) {
+                for (int i = 0; i < resolution; ++i) {
+                    auto p = grid->sample_position(i, j, k);
+                    auto falloff = 1.0;
+                    for (int a = 0; a < 3; a++) {
+                        const auto& axis = bounds.axis(a);
+                        auto d = 2 * (p[a] - axis.min) / axis.size() - 1;
+                        falloff *= fmax(0.0, 1 - d * d);
+                    }
+
+                    auto turb = noise.turb(frequency * p);
+                    grid->at(i, j, k) = static_cast<float>(fmax(0.0, turb - threshold) * falloff);
+                }
+            }
+        }
+
+        return grid;
+    }
+
+    float& at(int i, int j, int k) { return values[(k * ny + j) * nx + i]; }
+    float at(int i, int j, int k) const { return values[(k * ny + j) * nx + i]; }
+
+    Point3d sample_position(int i, int j, int k) const {
+        return Point3d(bounds.x.min + bounds.x.size() * i / (nx - 1),
+                       bounds.y.min + bounds.y.size() * j / (ny - 1),
+                       bounds.z.min + bounds.z.size() * k / (nz - 1));
+    }
+
+    double density(const Point3d& p) const {
+        double gx, gy, gz;
+        if (!to_grid(p, gx, gy, gz)) {
+            return 0;
+        }
+
+        auto i = std::min(static_cast<int>(gx), nx - 2);
+        auto j = std::min(static_cast<int>(gy), ny - 2);
+        auto k = std::min(static_cast<int>(gz), nz - 2);
+        auto fx = gx - i, fy = gy - j, fz = gz - k;
+
+        auto c00 = at(i, j, k) * (1 - fx) + at(i + 1, j, k) * fx;
+        auto c10 = at(i, j + 1, k) * (1 - fx) + at(i + 1, j + 1, k) * fx;
+        auto c01 = at(i, j, k + 1) * (1 - fx) + at(i + 1, j, k + 1) * fx;
+        auto c11 = at(i, j + 1, k + 1) * (1 - fx) + at(i + 1, j + 1, k + 1) * fx;
+
+        auto c0 = c00 * (1 - fy) + c10 * fy;
+        auto c1 = c01 * (1 - fy) + c11 * fy;
+
+        return c0 * (1 - fz) + c1 * fz;
+    }
+
+    // Largest sample among those that influence the box [lo, hi] (in grid coordinates).
+    double max_over(const Point3d& lo, const Point3d& hi) const {
+        auto i0 = std::clamp(static_cast<int>(floor(lo.x())), 0, nx - 1);
+        auto j0 = std::clamp(static_cast<int>(floor(lo.y())), 0, ny - 1);
+        auto k0 = std::clamp(static_cast<int>(floor(lo.z())), 0, nz - 1);
+        auto i1 = std::clamp(static_cast<int>(ceil(hi.x())), 0, nx - 1);
+        auto j1 = std::clamp(static_cast<int>(ceil(hi.y())), 0, ny - 1);
+        auto k1 = std::clamp(static_cast<int>(ceil(hi.z())), 0, nz - 1);
+
+        float result = 0;
+        for (int k = k0; k <= k1; ++k) {
+            for (int j = j0; j <= j1; ++j) {
+                for (int i = i0; i <= i1; ++i) {
+                    result = std::max(result, at(i, j, k));
+                }
+            }
+        }
+
+        return result;
+    }
+
+    const Aabb& bounding_box() const { return bounds; }
+
+    int resolution(int axis) const { return axis == 0 ? nx : axis == 1 ? ny : nz; }
+
+private:
+    Aabb bounds;
+    int nx, ny, nz;
+    std::vector<float> values;
+
+    bool to_grid(const Point3d& p, double& gx, double& gy, double& gz) const {
+        if (!bounds.x.contains(p.x()) || !bounds.y.contains(p.y()) || !bounds.z.contains(p.z())) {
+            return false;
+        }
+
+        gx = (p.x() - bounds.x.min) / bounds.x.size() * (nx - 1);
+        gy = (p.y() - bounds.y.min) / bounds.y.size() * (ny - 1);
+        gz = (p.z() - bounds.z.min) / bounds.z.size() * (nz - 1);
+        return true;
+    }
+};
+
+// Coarse grid of density upper bounds over a DensityGrid. Free-flight sampling walks the cells a
+// ray crosses and samples each with its own majorant, so thin regions are crossed in few steps.
+class MajorantGrid {
+public:
+    MajorantGrid(const DensityGrid& grid, int resolution)
+        : bounds(grid.bounding_box()), res(resolution), majorants(res * res * res) {
+        for (int k = 0; k < res; ++k) {
+            for (int j = 0; j < res; ++j) {
+                for (int i = 0; i < res; ++i) {
+                    Point3d lo(to_grid(0, grid, i), to_grid(1, grid, j), to_grid(2, grid, k));
+                    Point3d hi(to_grid(0, grid, i + 1), to_grid(1, grid, j + 1),
+                               to_grid(2, grid, k + 1));
+                    majorants[(k * res + j) * res + i] = grid.max_over(lo, hi);
+                }
+            }
+        }
+    }
+
+    // Calls visit(t_enter, t_exit, majorant) for every cell the ray crosses within ray_t, front
+    // to back, until visit returns false.
+    template <typename Visitor>
+    void walk(const Ray& r, Interval ray_t, Visitor visit) const {
+        if (!clip(r, ray_t)) {
+            return;
+        }
+
+        int cell[3], step[3];
+        double t_next[3], t_delta[3];
+        auto p = r.at(ray_t.min);
+
+        for (int a = 0; a < 3; a++) {
+            const auto& axis = bounds.axis(a);
+            auto cell_size = axis.size() / res;
+            auto dir = r.direction()[a];
+
+            cell[a] = std::clamp(static_cast<int>((p[a] - axis.min) / cell_size), 0, res - 1);
+
+            if (dir > 0) {
+                step[a] = 1;
+                t_next[a] = ray_t.min + (axis.min + (cell[a] + 1) * cell_size - p[a]) / dir;
+                t_delta[a] = cell_size / dir;
+            } else if (dir < 0) {
+                step[a] = -1;
+                t_next[a] = ray_t.min + (axis.min + cell[a] * cell_size - p[a]) / dir;
+                t_delta[a] = -cell_size / dir;
+            } else {
+                step[a] = 0;
+                t_next[a] = infinity;
+                t_delta[a] = infinity;
+            }
+        }
+
+        auto t = ray_t.min;
+        while (t < ray_t.max) {
+            int a = (t_next[0] < t_next[1]) ? (t_next[0] < t_next[2] ? 0 : 2)
+                                            : (t_next[1] < t_next[2] ? 1 : 2);
+            auto t_exit = fmin(t_next[a], ray_t.max);
+
+            if (!visit(t, t_exit, majorants[(cell[2] * res + cell[1]) * res + cell[0]])) {
+                return;
+            }
+
+            t = t_exit;
+            cell[a] += step[a];
+            if (cell[a] < 0 || cell[a] >= res) {
+                return;
+            }
+            t_next[a] += t_delta[a];
+        }
+    }
+
+private:
+    Aabb bounds;
+    int res;
+    std::vector<double> majorants;
+
+    double to_grid(int axis, const DensityGrid& grid, int cell) const {
+        return static_cast<double>(cell) / res * (grid.resolution(axis) - 1);
+    }
+
+    bool clip(const Ray& r, Interval& ray_t) const {
+        for (int a = 0; a < 3; a++) {
+            auto invD = 1 / r.direction()[a];
+            auto orig = r.origin()[a];
+
+            auto t0 = (bounds.axis(a).min - orig) * invD;
+            auto t1 = (bounds.axis(a).max - orig) * invD;
+
+            if (invD < 0) std::swap(t0, t1);
+
+            ray_t.min = fmax(ray_t.min, t0);
+            ray_t.max = fmin(ray_t.max, t1);
+        }
+
+        return ray_t.min < ray_t.max;
+    }
+};
+
+#endif  // VOLUME_H